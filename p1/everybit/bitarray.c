@@ -24,15 +24,53 @@
 // array containing bit_sz bits will consume roughly bit_sz/8 bytes of
 // memory.
 
+// We need _POSIX_C_SOURCE >= 200809L to use pread and pwrite.
+#define _POSIX_C_SOURCE 200809L
+
 #include "./bitarray.h"
 
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
+
+// ******************************** Constants *******************************
+
+// Size of each buffer bitarray_file_rotate streams a file through.  It holds
+// three of them, so this bounds its memory use.  Must be a multiple of 8.
+#ifndef BITARRAY_FILE_CHUNK_BYTES
+#define BITARRAY_FILE_CHUNK_BYTES (1 << 20)
+#endif
+
+#define BITARRAY_FILE_CHUNK_BITS ((size_t)BITARRAY_FILE_CHUNK_BYTES * 8)
+
+// bitarray_rotate_many batches arrays of up to 64 * SMALL_MAX_WORDS bits into
+// groups of ROTATE_LANES arrays with the same number of words, and rotates
+// each group with one pass of a kernel that handles all of its lanes at once.
+#define SMALL_MAX_WORDS 8
+#define ROTATE_LANES 4
+
+// Number of size classes: arrays of 1, 2, 4 and SMALL_MAX_WORDS words, plus
+// one for arrays too large to batch.
+#define ROTATE_CLASSES 5
+
+// bitarray_rotate_many splits batches across threads, each getting at least
+// this many operations.
+#define ROTATE_MANY_GRAIN 16384
+
+// Alignment of bit array headers and buffers that share an allocation.
+#define BITARRAY_ALIGN 16
+
+// Default size of the blocks a bitarray_arena_t allocates.
+#define BITARRAY_ARENA_BLOCK_BYTES (1 << 20)
 
 // ********************************* Types **********************************
 
@@ -43,10 +81,47 @@ struct bitarray {
   size_t bit_sz;
 
   // The underlying memory buffer that stores the bits in
-  // packed form (8 per byte).
+  // packed form (8 per byte).  It directly follows the struct in the same
+  // allocation.
   char* restrict buf;
+
+  // True if the bit array lives in a bitarray_arena_t, which owns its memory.
+  bool in_arena;
+};
+
+// A block of memory that an arena carves bit arrays out of.  Its data
+// follows the struct, at an offset of ARENA_BLOCK_HEADER_BYTES.
+typedef struct arena_block {
+  struct arena_block* next;
+
+  // Usable bytes in the block, and how many of them are handed out.
+  size_t sz;
+  size_t used;
+} arena_block_t;
+
+// Concrete data type representing an arena of bit arrays.
+struct bitarray_arena {
+  size_t block_sz;
+
+  // Blocks of block_sz bytes, in the order they were allocated, and the one
+  // allocations are currently taken from.  Blocks after current were used
+  // before the last reset and are reused as allocation reaches them.
+  arena_block_t* blocks;
+  arena_block_t* current;
+
+  // Blocks holding a single bit array too large for a standard block.  These
+  // are freed on reset.
+  arena_block_t* large;
 };
 
+// Rounds n up to a multiple of BITARRAY_ALIGN.
+#define ALIGN_UP(n) (((n) + BITARRAY_ALIGN - 1) / BITARRAY_ALIGN * BITARRAY_ALIGN)
+
+// Space taken by a bit array header ahead of its buffer, and by an arena
+// block header ahead of its data.
+#define BITARRAY_HEADER_BYTES ALIGN_UP(sizeof(struct bitarray))
+#define ARENA_BLOCK_HEADER_BYTES ALIGN_UP(sizeof(arena_block_t))
+
 // ******************** Prototypes for static functions *********************
 
 // Rotates a subarray left by an arbitrary number of bits.
@@ -113,36 +188,88 @@ static void store64(char* const restrict buf, const size_t bit_offset,
 static void bitarray_reverse(bitarray_t* const bitarray,
                              const size_t bit_offset, const size_t bit_length);
 
+// Produces a word with the low nbits bits set, for 0 <= nbits <= 64.
+static uint64_t low_mask(const size_t nbits);
+
+// Returns the number of bytes to allocate for the buffer of a bit array of
+// bit_sz bits: ceil(bit_sz/8), plus two words of slack, since load64 and
+// store64 touch the two words starting at the byte that holds bit_offset,
+// which can run past the last byte of the bit array.
+static size_t buffer_sz(const size_t bit_sz);
+
+// Sets up a bit array header at mem, with its buffer following it.  The
+// memory must be zero-filled.
+static bitarray_t* bitarray_init(char* const mem, const size_t bit_sz,
+                                 const bool in_arena);
+
+// Allocates an arena block with sz usable bytes.
+static arena_block_t* arena_block_new(const size_t sz);
+
+// Buffers used to stream a file-resident bit array through memory.  Each
+// chunk holds up to BITARRAY_FILE_CHUNK_BITS bits starting at bit 0; raw
+// holds the file bytes a chunk is read from or written to.
+typedef struct {
+  int fd;
+  char* chunk_a;
+  char* chunk_b;
+  char* raw;
+} file_stream_t;
+
+// Reads bits [bit_index, bit_index + bit_length) of the file into chunk,
+// starting at bit 0.  Returns 0 on success and -1 on an I/O error.
+static int file_read_bits(const file_stream_t* const stream, char* const chunk,
+                          const size_t bit_index, const size_t bit_length);
+
+// Writes the first bit_length bits of chunk to bits
+// [bit_index, bit_index + bit_length) of the file, leaving the bits around
+// them untouched.  Returns 0 on success and -1 on an I/O error.
+static int file_write_bits(const file_stream_t* const stream,
+                           const char* const chunk, const size_t bit_index,
+                           const size_t bit_length);
+
+// Swaps the disjoint file ranges [a, a + bit_length) and
+// [b, b + bit_length), a chunk at a time.
+static int file_swap_bits(const file_stream_t* const stream, const size_t a,
+                          const size_t b, const size_t bit_length);
+
+// Moves the file range [src, src + bit_length) to [dst, dst + bit_length).
+// The ranges may overlap; chunks are copied in whichever direction never
+// overwrites bits that have not been read yet.
+static int file_move_bits(const file_stream_t* const stream, const size_t dst,
+                          const size_t src, const size_t bit_length);
+
 // ******************************* Functions ********************************
 
 bitarray_t* bitarray_new(const size_t bit_sz) {
-  // Allocate an underlying buffer of ceil(bit_sz/8) bytes.
-  char* const buf = calloc(1, (bit_sz + 7) / 8);
-  if (buf == NULL) {
-    return NULL;
-  }
-
-  // Allocate space for the struct.
-  bitarray_t* const bitarray = malloc(sizeof(struct bitarray));
-  if (bitarray == NULL) {
-    free(buf);
+  // Allocate space for the struct and the underlying buffer together.
+  char* const mem = calloc(1, BITARRAY_HEADER_BYTES + buffer_sz(bit_sz));
+  if (mem == NULL) {
     return NULL;
   }
-
-  bitarray->buf = buf;
-  bitarray->bit_sz = bit_sz;
-  return bitarray;
+  return bitarray_init(mem, bit_sz, false);
 }
 
 void bitarray_free(bitarray_t* const bitarray) {
-  if (bitarray == NULL) {
+  // Bit arrays in an arena are released with the arena.
+  if (bitarray == NULL || bitarray->in_arena) {
     return;
   }
-  free(bitarray->buf);
-  bitarray->buf = NULL;
   free(bitarray);
 }
 
+static size_t buffer_sz(const size_t bit_sz) {
+  return (bit_sz + 7) / 8 + 2 * sizeof(uint64_t);
+}
+
+static bitarray_t* bitarray_init(char* const mem, const size_t bit_sz,
+                                 const bool in_arena) {
+  bitarray_t* const bitarray = (bitarray_t*)mem;
+  bitarray->buf = mem + BITARRAY_HEADER_BYTES;
+  bitarray->bit_sz = bit_sz;
+  bitarray->in_arena = in_arena;
+  return bitarray;
+}
+
 size_t bitarray_get_bit_sz(const bitarray_t* const bitarray) {
   return bitarray->bit_sz;
 }
@@ -246,7 +373,9 @@ load64(const char* const restrict buf, const size_t bit_offset) {
   const uint64_t* const restrict buf64 = (uint64_t*)(buf + byte_offset);
   uint64_t w0 = buf64[0];
   uint64_t w1 = buf64[1];
-  return (w0 >> subbyte_offset) | (w1 << (64 - subbyte_offset));
+  // Shift w1 in two steps so that a byte-aligned offset shifts it out
+  // entirely rather than shifting by 64, which is undefined.
+  return (w0 >> subbyte_offset) | ((w1 << 1) << (63 - subbyte_offset));
 }
 
 static inline __attribute__((always_inline)) void store64(
@@ -259,9 +388,9 @@ static inline __attribute__((always_inline)) void store64(
   uint64_t w1 = buf64[1];
 
   uint64_t m0 = (~0ULL) << subbyte_offset;
-  uint64_t m1 = (~0ULL) >> (64 - subbyte_offset);
+  uint64_t m1 = ~m0;
   w0 = (w0 & ~m0) | ((val << subbyte_offset) & m0);
-  w1 = (w1 & ~m1) | ((val >> (64 - subbyte_offset)) & m1);
+  w1 = (w1 & ~m1) | (((val >> 1) >> (63 - subbyte_offset)) & m1);
 
   buf64[0] = w0;
   buf64[1] = w1;
@@ -301,3 +430,779 @@ static inline void bitarray_reverse(bitarray_t* const restrict bitarray,
     bitarray_set(bitarray, j, bit_i);
   }
 }
+
+static inline uint64_t low_mask(const size_t nbits) {
+  return nbits >= 64 ? ~0ULL : (1ULL << nbits) - 1;
+}
+
+// ********************************* Arenas *********************************
+
+static arena_block_t* arena_block_new(const size_t sz) {
+  arena_block_t* const block = malloc(ARENA_BLOCK_HEADER_BYTES + sz);
+  if (block == NULL) {
+    return NULL;
+  }
+  block->next = NULL;
+  block->sz = sz;
+  block->used = 0;
+  return block;
+}
+
+static char* arena_block_data(arena_block_t* const block) {
+  return (char*)block + ARENA_BLOCK_HEADER_BYTES;
+}
+
+static void arena_block_free_all(arena_block_t* block) {
+  while (block != NULL) {
+    arena_block_t* const next = block->next;
+    free(block);
+    block = next;
+  }
+}
+
+bitarray_arena_t* bitarray_arena_new(const size_t block_sz) {
+  bitarray_arena_t* const arena = malloc(sizeof(struct bitarray_arena));
+  if (arena == NULL) {
+    return NULL;
+  }
+  arena->block_sz =
+      ALIGN_UP(block_sz == 0 ? BITARRAY_ARENA_BLOCK_BYTES : block_sz);
+  arena->blocks = NULL;
+  arena->current = NULL;
+  arena->large = NULL;
+  return arena;
+}
+
+void bitarray_arena_delete(bitarray_arena_t* const arena) {
+  if (arena == NULL) {
+    return;
+  }
+  arena_block_free_all(arena->blocks);
+  arena_block_free_all(arena->large);
+  free(arena);
+}
+
+bitarray_t* bitarray_arena_alloc(bitarray_arena_t* const arena,
+                                 const size_t bit_sz) {
+  const size_t sz = BITARRAY_HEADER_BYTES + ALIGN_UP(buffer_sz(bit_sz));
+  char* mem;
+
+  if (sz > arena->block_sz) {
+    // Give an oversized bit array a block of its own.
+    arena_block_t* const block = arena_block_new(sz);
+    if (block == NULL) {
+      return NULL;
+    }
+    block->next = arena->large;
+    arena->large = block;
+    block->used = sz;
+    mem = arena_block_data(block);
+  } else {
+    // Bump-allocate from the current block, moving on to the next one, or a
+    // new one, once it is full.
+    arena_block_t* block = arena->current;
+    while (block == NULL || block->used + sz > block->sz) {
+      if (block != NULL && block->next != NULL) {
+        block = block->next;
+        block->used = 0;
+        continue;
+      }
+      arena_block_t* const fresh = arena_block_new(arena->block_sz);
+      if (fresh == NULL) {
+        return NULL;
+      }
+      if (block == NULL) {
+        arena->blocks = fresh;
+      } else {
+        block->next = fresh;
+      }
+      block = fresh;
+    }
+    arena->current = block;
+    mem = arena_block_data(block) + block->used;
+    block->used += sz;
+  }
+
+  // Blocks are reused across resets, so clear the slice explicitly.
+  memset(mem, 0, sz);
+  return bitarray_init(mem, bit_sz, true);
+}
+
+void bitarray_arena_reset(bitarray_arena_t* const arena) {
+  arena_block_free_all(arena->large);
+  arena->large = NULL;
+  arena->current = arena->blocks;
+  if (arena->current != NULL) {
+    arena->current->used = 0;
+  }
+}
+
+// ************************** Batched rotation ****************************
+
+// Each lane array holds one value per lane, so that loops over lanes are
+// the innermost and vectorize across bit arrays.
+typedef uint64_t lanes_t[ROTATE_LANES];
+
+// Shifts each lane's words-word value right by amount[lane] bits, which must
+// be less than 64 * words.  Whole words are moved lane by lane; the
+// remaining bit shift is then done for all lanes together.
+static inline __attribute__((always_inline)) void lanes_shift_right(
+    lanes_t* const v, const size_t words, const uint64_t* const amount) {
+  lanes_t t[SMALL_MAX_WORDS + 1];
+  for (size_t l = 0; l < ROTATE_LANES; l++) {
+    const size_t q = amount[l] / 64;
+    for (size_t i = 0; i <= words; i++) {
+      t[i][l] = i + q < words ? v[i + q][l] : 0;
+    }
+  }
+  for (size_t i = 0; i < words; i++) {
+    for (size_t l = 0; l < ROTATE_LANES; l++) {
+      const uint64_t b = amount[l] % 64;
+      v[i][l] = (t[i][l] >> b) | ((t[i + 1][l] << 1) << (63 - b));
+    }
+  }
+}
+
+// Shifts each lane's words-word value left by amount[lane] bits, which must
+// be less than 64 * words.
+static inline __attribute__((always_inline)) void lanes_shift_left(
+    lanes_t* const v, const size_t words, const uint64_t* const amount) {
+  // t[i + 1] holds word i after the whole-word shift, and t[0] is zero.
+  lanes_t t[SMALL_MAX_WORDS + 1];
+  for (size_t l = 0; l < ROTATE_LANES; l++) {
+    const size_t q = amount[l] / 64;
+    t[0][l] = 0;
+    for (size_t i = 0; i < words; i++) {
+      t[i + 1][l] = i >= q ? v[i - q][l] : 0;
+    }
+  }
+  for (size_t i = 0; i < words; i++) {
+    for (size_t l = 0; l < ROTATE_LANES; l++) {
+      const uint64_t b = amount[l] % 64;
+      v[i][l] = (t[i + 1][l] << b) | ((t[i][l] >> 1) >> (63 - b));
+    }
+  }
+}
+
+// Rotates count <= ROTATE_LANES arrays, all of at most 64 * words bits, by
+// the operations ops[index[0]], ..., ops[index[count - 1]].
+//
+// Each lane computes, on its array A as a multiword integer,
+//   R  = (A >> offset) & mask(length)
+//   R' = ((R >> left) | (R << (length - left))) & mask(length)
+//   A' = (A & ~(mask(length) << offset)) | (R' << offset)
+static inline __attribute__((always_inline)) void rotate_lanes(
+    bitarray_t* const* const arrays, const rot_op_t* const ops,
+    const size_t* const index, const size_t count, const size_t words) {
+  lanes_t a[SMALL_MAX_WORDS];
+  lanes_t r[SMALL_MAX_WORDS];
+  lanes_t hi[SMALL_MAX_WORDS];
+  lanes_t mask[SMALL_MAX_WORDS];
+  uint64_t offset[ROTATE_LANES];
+  uint64_t length[ROTATE_LANES];
+  uint64_t left[ROTATE_LANES];
+  uint64_t back[ROTATE_LANES];
+
+  // Unused lanes rotate an empty range of an all-zero value.
+  memset(a, 0, sizeof(a));
+  for (size_t l = 0; l < ROTATE_LANES; l++) {
+    offset[l] = 0;
+    length[l] = 0;
+    left[l] = 0;
+  }
+  for (size_t l = 0; l < count; l++) {
+    const rot_op_t* const op = &ops[index[l]];
+    offset[l] = op->bit_offset;
+    length[l] = op->bit_length;
+    left[l] = modulo(-op->bit_right_amount, op->bit_length);
+    // Only touch the words the array spans; the buffer's slack makes the
+    // last of them readable in full even though it runs past bit_sz.
+    const char* const buf = arrays[index[l]]->buf;
+    const size_t array_words = (arrays[index[l]]->bit_sz + 63) / 64;
+    for (size_t i = 0; i < array_words; i++) {
+      memcpy(&a[i][l], buf + i * sizeof(uint64_t), sizeof(uint64_t));
+    }
+  }
+  for (size_t l = 0; l < ROTATE_LANES; l++) {
+    back[l] = length[l] - left[l];
+  }
+
+  for (size_t i = 0; i < words; i++) {
+    for (size_t l = 0; l < ROTATE_LANES; l++) {
+      const uint64_t lo = 64 * i;
+      const uint64_t n = (length[l] - lo) & 63;
+      mask[i][l] = length[l] >= lo + 64 ? ~0ULL
+                   : length[l] > lo     ? (1ULL << n) - 1
+                                        : 0;
+      r[i][l] = a[i][l];
+    }
+  }
+
+  lanes_shift_right(r, words, offset);
+  for (size_t i = 0; i < words; i++) {
+    for (size_t l = 0; l < ROTATE_LANES; l++) {
+      r[i][l] &= mask[i][l];
+      hi[i][l] = r[i][l];
+    }
+  }
+  lanes_shift_right(hi, words, left);
+  lanes_shift_left(r, words, back);
+  for (size_t i = 0; i < words; i++) {
+    for (size_t l = 0; l < ROTATE_LANES; l++) {
+      r[i][l] = (r[i][l] & mask[i][l]) | hi[i][l];
+    }
+  }
+  lanes_shift_left(r, words, offset);
+  lanes_shift_left(mask, words, offset);
+  for (size_t i = 0; i < words; i++) {
+    for (size_t l = 0; l < ROTATE_LANES; l++) {
+      a[i][l] = (a[i][l] & ~mask[i][l]) | r[i][l];
+    }
+  }
+
+  for (size_t l = 0; l < count; l++) {
+    char* const buf = arrays[index[l]]->buf;
+    const size_t array_words = (arrays[index[l]]->bit_sz + 63) / 64;
+    for (size_t i = 0; i < array_words; i++) {
+      memcpy(buf + i * sizeof(uint64_t), &a[i][l], sizeof(uint64_t));
+    }
+  }
+}
+
+// Returns the size class of a bit array: the index of the smallest of 1, 2,
+// 4 and SMALL_MAX_WORDS words that holds it, or ROTATE_CLASSES - 1 if none
+// does.
+static inline size_t rotate_class(const size_t bit_sz) {
+  const size_t words = (bit_sz + 63) / 64;
+  if (words <= 1) {
+    return 0;
+  } else if (words <= 2) {
+    return 1;
+  } else if (words <= 4) {
+    return 2;
+  } else if (words <= SMALL_MAX_WORDS) {
+    return 3;
+  }
+  return ROTATE_CLASSES - 1;
+}
+
+// Applies ops[begin, end) serially.  index is scratch space for end - begin
+// operation indices.
+static void rotate_many_range(bitarray_t* const* const arrays,
+                              const rot_op_t* const ops, const size_t begin,
+                              const size_t end, size_t* const index) {
+  // Counting sort of the operations by size class.  Large arrays are
+  // rotated directly, and operations that do nothing are dropped.
+  size_t class_start[ROTATE_CLASSES + 1] = {0};
+  for (size_t i = begin; i < end; i++) {
+    if (ops[i].bit_length == 0 || ops[i].bit_right_amount == 0) {
+      continue;
+    }
+    assert(ops[i].bit_offset + ops[i].bit_length <= arrays[i]->bit_sz);
+    class_start[rotate_class(arrays[i]->bit_sz) + 1]++;
+  }
+  for (size_t c = 0; c < ROTATE_CLASSES; c++) {
+    class_start[c + 1] += class_start[c];
+  }
+  size_t fill[ROTATE_CLASSES];
+  memcpy(fill, class_start, sizeof(fill));
+  for (size_t i = begin; i < end; i++) {
+    if (ops[i].bit_length == 0 || ops[i].bit_right_amount == 0) {
+      continue;
+    }
+    const size_t c = rotate_class(arrays[i]->bit_sz);
+    if (c == ROTATE_CLASSES - 1) {
+      bitarray_rotate(arrays[i], ops[i].bit_offset, ops[i].bit_length,
+                      ops[i].bit_right_amount);
+    } else {
+      index[fill[c]++] = i;
+    }
+  }
+
+  // Each call names its word count as a constant, so that the kernel is
+  // specialized and fully unrolled for each class.
+  for (size_t j = class_start[0]; j < class_start[1]; j += ROTATE_LANES) {
+    const size_t count = class_start[1] - j;
+    rotate_lanes(arrays, ops, index + j,
+                 count < ROTATE_LANES ? count : ROTATE_LANES, 1);
+  }
+  for (size_t j = class_start[1]; j < class_start[2]; j += ROTATE_LANES) {
+    const size_t count = class_start[2] - j;
+    rotate_lanes(arrays, ops, index + j,
+                 count < ROTATE_LANES ? count : ROTATE_LANES, 2);
+  }
+  for (size_t j = class_start[2]; j < class_start[3]; j += ROTATE_LANES) {
+    const size_t count = class_start[3] - j;
+    rotate_lanes(arrays, ops, index + j,
+                 count < ROTATE_LANES ? count : ROTATE_LANES, 4);
+  }
+  for (size_t j = class_start[3]; j < class_start[4]; j += ROTATE_LANES) {
+    const size_t count = class_start[4] - j;
+    rotate_lanes(arrays, ops, index + j,
+                 count < ROTATE_LANES ? count : ROTATE_LANES,
+                 SMALL_MAX_WORDS);
+  }
+}
+
+// A slice of a bitarray_rotate_many batch, handed to one thread.
+typedef struct {
+  bitarray_t* const* arrays;
+  const rot_op_t* ops;
+  size_t begin;
+  size_t end;
+  size_t* index;
+} rotate_many_task_t;
+
+static void* rotate_many_worker(void* const arg) {
+  const rotate_many_task_t* const task = arg;
+  rotate_many_range(task->arrays, task->ops, task->begin, task->end,
+                    task->index);
+  return NULL;
+}
+
+void bitarray_rotate_many(bitarray_t* const* const arrays,
+                          const rot_op_t* const ops, const size_t n) {
+  size_t* const index = malloc(n * sizeof(size_t));
+  if (index == NULL) {
+    // Fall back to rotating one at a time rather than failing.
+    for (size_t i = 0; i < n; i++) {
+      bitarray_rotate(arrays[i], ops[i].bit_offset, ops[i].bit_length,
+                      ops[i].bit_right_amount);
+    }
+    return;
+  }
+
+  size_t num_threads = n / ROTATE_MANY_GRAIN;
+  const long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cpus > 0 && num_threads > (size_t)num_cpus) {
+    num_threads = num_cpus;
+  }
+  if (num_threads <= 1) {
+    rotate_many_range(arrays, ops, 0, n, index);
+    free(index);
+    return;
+  }
+
+  // Run the first slice on this thread and the rest on new ones.  A slice
+  // whose thread cannot be started is run here too.
+  rotate_many_task_t* const tasks =
+      malloc(num_threads * sizeof(rotate_many_task_t));
+  pthread_t* const threads = malloc(num_threads * sizeof(pthread_t));
+  bool* const started = calloc(num_threads, sizeof(bool));
+  if (tasks == NULL || threads == NULL || started == NULL) {
+    rotate_many_range(arrays, ops, 0, n, index);
+  } else {
+    for (size_t t = 0; t < num_threads; t++) {
+      tasks[t] = (rotate_many_task_t){
+          .arrays = arrays,
+          .ops = ops,
+          .begin = n * t / num_threads,
+          .end = n * (t + 1) / num_threads,
+          .index = index + n * t / num_threads,
+      };
+    }
+    for (size_t t = 1; t < num_threads; t++) {
+      started[t] = pthread_create(&threads[t], NULL, rotate_many_worker,
+                                  &tasks[t]) == 0;
+    }
+    rotate_many_worker(&tasks[0]);
+    for (size_t t = 1; t < num_threads; t++) {
+      if (started[t]) {
+        pthread_join(threads[t], NULL);
+      } else {
+        rotate_many_worker(&tasks[t]);
+      }
+    }
+  }
+  free(started);
+  free(threads);
+  free(tasks);
+  free(index);
+}
+
+// *********************** File-resident bit arrays ************************
+
+// Reads exactly nbytes bytes at offset, retrying short reads.
+static int pread_full(const int fd, char* buf, size_t nbytes, off_t offset) {
+  while (nbytes > 0) {
+    const ssize_t n = pread(fd, buf, nbytes, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    if (n == 0) {
+      errno = EIO;
+      return -1;
+    }
+    buf += n;
+    nbytes -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+// Writes exactly nbytes bytes at offset, retrying short writes.
+static int pwrite_full(const int fd, const char* buf, size_t nbytes,
+                       off_t offset) {
+  while (nbytes > 0) {
+    const ssize_t n = pwrite(fd, buf, nbytes, offset);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    buf += n;
+    nbytes -= n;
+    offset += n;
+  }
+  return 0;
+}
+
+static int file_read_bits(const file_stream_t* const stream, char* const chunk,
+                          const size_t bit_index, const size_t bit_length) {
+  assert(bit_length <= BITARRAY_FILE_CHUNK_BITS);
+  const size_t subbyte_offset = bit_index & 7;
+  const size_t nbytes = (subbyte_offset + bit_length + 7) / 8;
+  if (pread_full(stream->fd, stream->raw, nbytes, bit_index / 8) < 0) {
+    return -1;
+  }
+
+  // Shift the bits down to start at bit 0, a word at a time.
+  uint64_t* const words = (uint64_t*)chunk;
+  for (size_t k = 0; k * 64 < bit_length; k++) {
+    words[k] = load64(stream->raw, subbyte_offset + k * 64);
+  }
+  return 0;
+}
+
+static int file_write_bits(const file_stream_t* const stream,
+                           const char* const chunk, const size_t bit_index,
+                           const size_t bit_length) {
+  assert(bit_length <= BITARRAY_FILE_CHUNK_BITS);
+  char* const restrict raw = stream->raw;
+  const size_t first_byte = bit_index / 8;
+  const size_t subbyte_offset = bit_index & 7;
+  const size_t end_offset = subbyte_offset + bit_length;
+  const size_t nbytes = (end_offset + 7) / 8;
+
+  // Fetch the bytes the range only partly covers, so that the bits around
+  // it are written back unchanged.
+  if (subbyte_offset != 0 &&
+      pread_full(stream->fd, raw, 1, first_byte) < 0) {
+    return -1;
+  }
+  if ((end_offset & 7) != 0 &&
+      pread_full(stream->fd, raw + nbytes - 1, 1, first_byte + nbytes - 1) <
+          0) {
+    return -1;
+  }
+
+  const uint64_t* const words = (const uint64_t*)chunk;
+  size_t k = 0;
+  for (; (k + 1) * 64 <= bit_length; k++) {
+    store64(raw, subbyte_offset + k * 64, words[k]);
+  }
+  const size_t tail = bit_length - k * 64;
+  if (tail > 0) {
+    const size_t i = subbyte_offset + k * 64;
+    const uint64_t mask = low_mask(tail);
+    store64(raw, i, (load64(raw, i) & ~mask) | (words[k] & mask));
+  }
+  return pwrite_full(stream->fd, raw, nbytes, first_byte);
+}
+
+static int file_swap_bits(const file_stream_t* const stream, const size_t a,
+                          const size_t b, const size_t bit_length) {
+  for (size_t done = 0; done < bit_length; done += BITARRAY_FILE_CHUNK_BITS) {
+    const size_t n = bit_length - done < BITARRAY_FILE_CHUNK_BITS
+                         ? bit_length - done
+                         : BITARRAY_FILE_CHUNK_BITS;
+    if (file_read_bits(stream, stream->chunk_a, a + done, n) < 0 ||
+        file_read_bits(stream, stream->chunk_b, b + done, n) < 0 ||
+        file_write_bits(stream, stream->chunk_b, a + done, n) < 0 ||
+        file_write_bits(stream, stream->chunk_a, b + done, n) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int file_move_bits(const file_stream_t* const stream, const size_t dst,
+                          const size_t src, const size_t bit_length) {
+  if (dst < src) {
+    for (size_t done = 0; done < bit_length;
+         done += BITARRAY_FILE_CHUNK_BITS) {
+      const size_t n = bit_length - done < BITARRAY_FILE_CHUNK_BITS
+                           ? bit_length - done
+                           : BITARRAY_FILE_CHUNK_BITS;
+      if (file_read_bits(stream, stream->chunk_b, src + done, n) < 0 ||
+          file_write_bits(stream, stream->chunk_b, dst + done, n) < 0) {
+        return -1;
+      }
+    }
+  } else if (dst > src) {
+    size_t remaining = bit_length;
+    while (remaining > 0) {
+      const size_t n = remaining < BITARRAY_FILE_CHUNK_BITS
+                           ? remaining
+                           : BITARRAY_FILE_CHUNK_BITS;
+      remaining -= n;
+      if (file_read_bits(stream, stream->chunk_b, src + remaining, n) < 0 ||
+          file_write_bits(stream, stream->chunk_b, dst + remaining, n) < 0) {
+        return -1;
+      }
+    }
+  }
+  return 0;
+}
+
+// Rotates the file range [start, start + left + right) left by left bits.
+static int file_rotate_left(const file_stream_t* const stream, size_t start,
+                            size_t left, size_t right) {
+  // Block-swap (Gries-Mills) rotation: each swap puts one block in its final
+  // place and leaves a smaller rotation of the rest.  A short block swapped
+  // with a distant one makes for small scattered I/O, so only swap while
+  // both sides are too big to hold in a chunk.
+  while (left > BITARRAY_FILE_CHUNK_BITS && right > BITARRAY_FILE_CHUNK_BITS) {
+    if (left < right) {
+      // A B1 B2, with B2 as long as A, becomes B2 B1 A; rotate B2 B1 next.
+      if (file_swap_bits(stream, start, start + right, left) < 0) {
+        return -1;
+      }
+      right -= left;
+    } else {
+      // A1 A2 B, with A1 as long as B, becomes B A2 A1; rotate A2 A1 next.
+      if (file_swap_bits(stream, start, start + left, right) < 0) {
+        return -1;
+      }
+      start += right;
+      left -= right;
+    }
+  }
+
+  if (left == 0 || right == 0) {
+    return 0;
+  }
+  if (left <= BITARRAY_FILE_CHUNK_BITS) {
+    // Hold A in memory, slide B down over it, and put A back at the end.
+    if (file_read_bits(stream, stream->chunk_a, start, left) < 0 ||
+        file_move_bits(stream, start, start + left, right) < 0 ||
+        file_write_bits(stream, stream->chunk_a, start + right, left) < 0) {
+      return -1;
+    }
+  } else {
+    // Hold B in memory, slide A up over it, and put B back at the front.
+    if (file_read_bits(stream, stream->chunk_a, start + left, right) < 0 ||
+        file_move_bits(stream, start + right, start, left) < 0 ||
+        file_write_bits(stream, stream->chunk_a, start, right) < 0) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+int bitarray_file_rotate(const char* const path, const size_t bit_offset,
+                         const size_t bit_length,
+                         const ssize_t bit_right_amount) {
+  if (bit_length == 0) {
+    return 0;
+  }
+
+  // Convert a rotate left or right to a left rotate only, and eliminate
+  // multiple full rotations.
+  const size_t bit_left_amount = modulo(-bit_right_amount, bit_length);
+  if (bit_left_amount == 0) {
+    return 0;
+  }
+
+  file_stream_t stream;
+  stream.fd = open(path, O_RDWR);
+  if (stream.fd < 0) {
+    return -1;
+  }
+
+  struct stat st;
+  if (fstat(stream.fd, &st) < 0) {
+    close(stream.fd);
+    return -1;
+  }
+  if ((size_t)st.st_size < (bit_offset + bit_length + 7) / 8) {
+    close(stream.fd);
+    errno = EINVAL;
+    return -1;
+  }
+  posix_fadvise(stream.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+  // raw needs room for one byte of misalignment plus load64/store64 slack.
+  int result = -1;
+  stream.chunk_a = malloc(BITARRAY_FILE_CHUNK_BYTES);
+  stream.chunk_b = malloc(BITARRAY_FILE_CHUNK_BYTES);
+  stream.raw = calloc(1, BITARRAY_FILE_CHUNK_BYTES + 2 * sizeof(uint64_t));
+  if (stream.chunk_a != NULL && stream.chunk_b != NULL && stream.raw != NULL) {
+    result = file_rotate_left(&stream, bit_offset, bit_left_amount,
+                              bit_length - bit_left_amount);
+  }
+  free(stream.raw);
+  free(stream.chunk_b);
+  free(stream.chunk_a);
+
+  if (close(stream.fd) < 0) {
+    result = -1;
+  }
+  return result;
+}
+
+// ****************************** Bit streams *******************************
+
+void bitwriter_init(bitwriter_t* const writer, bitarray_t* const bitarray,
+                    const size_t bit_offset) {
+  assert(bit_offset <= bitarray->bit_sz);
+  writer->bitarray = bitarray;
+  writer->bit_index = bit_offset;
+  writer->pending = 0;
+  writer->pending_sz = 0;
+}
+
+void bitwriter_put(bitwriter_t* const writer, const uint64_t bits,
+                   const size_t nbits) {
+  assert(nbits <= 64);
+  assert(writer->bit_index + writer->pending_sz + nbits <=
+         writer->bitarray->bit_sz);
+
+  const uint64_t field = bits & low_mask(nbits);
+  const size_t pending_sz = writer->pending_sz;
+  writer->pending |= field << pending_sz;
+  if (pending_sz + nbits < 64) {
+    writer->pending_sz = pending_sz + nbits;
+    return;
+  }
+
+  // The buffer holds a full word; store it and keep whatever part of field
+  // did not fit.
+  store64(writer->bitarray->buf, writer->bit_index, writer->pending);
+  writer->bit_index += 64;
+  writer->pending = (field >> 1) >> (63 - pending_sz);
+  writer->pending_sz = pending_sz + nbits - 64;
+}
+
+size_t bitwriter_flush(bitwriter_t* const writer) {
+  if (writer->pending_sz > 0) {
+    char* const restrict buf = writer->bitarray->buf;
+    const size_t i = writer->bit_index;
+    const uint64_t mask = low_mask(writer->pending_sz);
+    store64(buf, i, (load64(buf, i) & ~mask) | writer->pending);
+    writer->bit_index += writer->pending_sz;
+    writer->pending = 0;
+    writer->pending_sz = 0;
+  }
+  return writer->bit_index;
+}
+
+void bitreader_init(bitreader_t* const reader,
+                    const bitarray_t* const bitarray,
+                    const size_t bit_offset) {
+  assert(bit_offset <= bitarray->bit_sz);
+  reader->bitarray = bitarray;
+  reader->bit_index = bit_offset;
+}
+
+uint64_t bitreader_get(bitreader_t* const reader, const size_t nbits) {
+  assert(nbits <= 64);
+  assert(reader->bit_index + nbits <= reader->bitarray->bit_sz);
+
+  const uint64_t bits =
+      load64(reader->bitarray->buf, reader->bit_index) & low_mask(nbits);
+  reader->bit_index += nbits;
+  return bits;
+}
+
+// Reads a unary-coded count: the number of zeros before the next one.  The
+// zeros and the terminating one are consumed.
+static inline uint64_t bitreader_get_unary(bitreader_t* const reader) {
+  const char* const restrict buf = reader->bitarray->buf;
+  uint64_t count = 0;
+  uint64_t word = load64(buf, reader->bit_index);
+  while (word == 0) {
+    count += 64;
+    reader->bit_index += 64;
+    word = load64(buf, reader->bit_index);
+  }
+  const size_t zeros = __builtin_ctzll(word);
+  reader->bit_index += zeros + 1;
+  assert(reader->bit_index <= reader->bitarray->bit_sz);
+  return count + zeros;
+}
+
+void bitwriter_put_gamma(bitwriter_t* const writer,
+                         const uint64_t* const values, const size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    const uint64_t x = values[i];
+    assert(x >= 1);
+    const size_t log = 63 - __builtin_clzll(x);
+    bitwriter_put(writer, 1ULL << log, log + 1);
+    bitwriter_put(writer, x, log);
+  }
+}
+
+void bitreader_get_gamma(bitreader_t* const reader, uint64_t* const values,
+                         const size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    const size_t log = bitreader_get_unary(reader);
+    assert(log < 64);
+    values[i] = (1ULL << log) | bitreader_get(reader, log);
+  }
+}
+
+void bitwriter_put_rice(bitwriter_t* const writer,
+                        const uint64_t* const values, const size_t n,
+                        const size_t k) {
+  assert(k < 64);
+  for (size_t i = 0; i < n; i++) {
+    uint64_t q = values[i] >> k;
+    while (q >= 64) {
+      bitwriter_put(writer, 0, 64);
+      q -= 64;
+    }
+    bitwriter_put(writer, 1ULL << q, q + 1);
+    bitwriter_put(writer, values[i], k);
+  }
+}
+
+void bitreader_get_rice(bitreader_t* const reader, uint64_t* const values,
+                        const size_t n, const size_t k) {
+  assert(k < 64);
+  for (size_t i = 0; i < n; i++) {
+    const uint64_t q = bitreader_get_unary(reader);
+    values[i] = (q << k) | bitreader_get(reader, k);
+  }
+}
+
+void bitwriter_put_varint(bitwriter_t* const writer,
+                          const uint64_t* const values, const size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint64_t x = values[i];
+    while (x >= 0x80) {
+      bitwriter_put(writer, (x & 0x7f) | 0x80, 8);
+      x >>= 7;
+    }
+    bitwriter_put(writer, x, 8);
+  }
+}
+
+void bitreader_get_varint(bitreader_t* const reader, uint64_t* const values,
+                          const size_t n) {
+  for (size_t i = 0; i < n; i++) {
+    uint64_t x = 0;
+    uint64_t group;
+    size_t shift = 0;
+    do {
+      group = bitreader_get(reader, 8);
+      x |= (group & 0x7f) << shift;
+      shift += 7;
+    } while ((group & 0x80) && shift < 64);
+    values[i] = x;
+  }
+}
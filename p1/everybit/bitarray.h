@@ -25,21 +25,79 @@
 
 #include <sys/types.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 // ********************************* Types **********************************
 
 // Abstract data type representing an array of bits.
 typedef struct bitarray bitarray_t;
 
+// Abstract data type representing a region that bit arrays are allocated
+// from in bulk and released all at once.
+typedef struct bitarray_arena bitarray_arena_t;
+
+// A rotation of one bit array.  The fields have the same meaning as the
+// arguments of bitarray_rotate.
+typedef struct {
+  size_t bit_offset;
+  size_t bit_length;
+  ssize_t bit_right_amount;
+} rot_op_t;
+
+// Cursor for writing a stream of variable-width bit fields into a bit array.
+//
+// Fields are laid down least significant bit first: bit i of a field lands
+// at bit index bit_index + i.  Whole words are buffered in pending before
+// they are stored, so a stream must be finished with bitwriter_flush before
+// the bit array is read.
+typedef struct {
+  bitarray_t* bitarray;
+
+  // Index of the first bit that has not been stored yet.
+  size_t bit_index;
+
+  // Buffered bits that belong at bit_index and onwards, and their count.
+  // pending_sz is always less than 64.
+  uint64_t pending;
+  size_t pending_sz;
+} bitwriter_t;
+
+// Cursor for reading a stream of variable-width bit fields from a bit array,
+// in the layout produced by bitwriter_t.
+typedef struct {
+  const bitarray_t* bitarray;
+
+  // Index of the next bit to read.
+  size_t bit_index;
+} bitreader_t;
+
 // ******************************* Prototypes *******************************
 
 // Allocates space for a new bit array.
 // bit_sz is the number of bits storable in the resultant bit array
 bitarray_t* bitarray_new(const size_t bit_sz);
 
-// Frees a bit array allocated by bitarray_new.
+// Frees a bit array allocated by bitarray_new.  Does nothing for a bit
+// array allocated from an arena.
 void bitarray_free(bitarray_t* const bitarray);
 
+// Creates an arena that hands out memory in blocks of block_sz bytes, or of
+// a default size if block_sz is 0.
+bitarray_arena_t* bitarray_arena_new(const size_t block_sz);
+
+// Frees an arena and every bit array allocated from it.
+void bitarray_arena_delete(bitarray_arena_t* const arena);
+
+// Allocates space for a new bit array from an arena.  The bit array is
+// zero-filled, exactly as from bitarray_new, and works with every other
+// function here, but its header and buffer share one slice of an arena block.
+bitarray_t* bitarray_arena_alloc(bitarray_arena_t* const arena,
+                                 const size_t bit_sz);
+
+// Releases every bit array allocated from an arena.  The arena keeps its
+// blocks to reuse for later allocations.
+void bitarray_arena_reset(bitarray_arena_t* const arena);
+
 // Returns the number of bits stored in a bit array.
 // Note the invariant bitarray_get_bit_sz(bitarray_new(n)) = n.
 size_t bitarray_get_bit_sz(const bitarray_t* const bitarray);
@@ -85,4 +143,90 @@ void bitarray_rotate(bitarray_t* const bitarray,
                      const size_t bit_length,
                      const ssize_t bit_right_amount);
 
+// Applies ops[i] to arrays[i] for every i < n, as if by calling
+// bitarray_rotate on each in turn.
+//
+// The arrays must be distinct: operations are regrouped by array size and
+// may run in any order and in parallel.  Arrays of up to 512 bits are
+// rotated several at a time, in registers, which is much cheaper per
+// operation than bitarray_rotate for small arrays.
+void bitarray_rotate_many(bitarray_t* const* const arrays,
+                          const rot_op_t* const ops,
+                          const size_t n);
+
+// Rotates a subarray of a bit array stored in a file, without loading the
+// whole subarray into memory.
+//
+// The file at path holds the packed bits in the same layout as a bit array's
+// buffer: bit i is bit (i mod 8) of byte floor(i / 8).  bit_offset,
+// bit_length and bit_right_amount have the same meaning as for
+// bitarray_rotate.  The file is rewritten in place through a few fixed-size
+// buffers, using only sequential block reads and writes.
+//
+// Returns 0 on success and -1 if the file could not be opened, is too short
+// to hold the subarray, or could not be read or written; errno is set.
+int bitarray_file_rotate(const char* const path,
+                         const size_t bit_offset,
+                         const size_t bit_length,
+                         const ssize_t bit_right_amount);
+
+// ****************************** Bit streams *******************************
+
+// Starts a bit stream at bit_offset in the bit array.
+void bitwriter_init(bitwriter_t* const writer,
+                    bitarray_t* const bitarray,
+                    const size_t bit_offset);
+
+// Appends the low nbits bits of bits to the stream, for 0 <= nbits <= 64.
+// The stream must not run past the end of the bit array.
+void bitwriter_put(bitwriter_t* const writer,
+                   const uint64_t bits,
+                   const size_t nbits);
+
+// Stores any buffered bits.  Returns the index one past the last bit written,
+// which is where a bitreader_t would end up after reading the whole stream.
+size_t bitwriter_flush(bitwriter_t* const writer);
+
+// Starts reading a bit stream at bit_offset in the bit array.
+void bitreader_init(bitreader_t* const reader,
+                    const bitarray_t* const bitarray,
+                    const size_t bit_offset);
+
+// Reads the next nbits bits of the stream, for 0 <= nbits <= 64, and returns
+// them in the low bits of the result.
+uint64_t bitreader_get(bitreader_t* const reader, const size_t nbits);
+
+// Batched variable-length codes.  Each encoder appends n values to the stream
+// and the matching decoder reads n values back into values.
+//
+// Elias-gamma codes a value x >= 1 in 2 * floor(log2(x)) + 1 bits: a unary
+// prefix of floor(log2(x)) zeros and a one, then the bits of x below its
+// leading one.
+//
+// Golomb-Rice codes a value x with parameter k < 64 in (x >> k) + 1 + k
+// bits: x >> k in unary, then the low k bits of x.
+//
+// Varint codes a value in groups of 7 bits, low group first, each followed
+// by a continuation bit that is set if more groups follow.
+void bitwriter_put_gamma(bitwriter_t* const writer,
+                         const uint64_t* const values,
+                         const size_t n);
+void bitreader_get_gamma(bitreader_t* const reader,
+                         uint64_t* const values,
+                         const size_t n);
+void bitwriter_put_rice(bitwriter_t* const writer,
+                        const uint64_t* const values,
+                        const size_t n,
+                        const size_t k);
+void bitreader_get_rice(bitreader_t* const reader,
+                        uint64_t* const values,
+                        const size_t n,
+                        const size_t k);
+void bitwriter_put_varint(bitwriter_t* const writer,
+                          const uint64_t* const values,
+                          const size_t n);
+void bitreader_get_varint(bitreader_t* const reader,
+                          uint64_t* const values,
+                          const size_t n);
+
 #endif  // BITARRAY_H
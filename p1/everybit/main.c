@@ -26,6 +26,7 @@
 // We need _POSIX_C_SOURCE >= 2 to use getopt.
 #define _POSIX_C_SOURCE 200112L
 
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 
@@ -47,11 +48,19 @@ int main(int argc, char** argv) {
   char optchar;
   opterr = 0;
   int selected_test = -1;
-  while ((optchar = getopt(argc, argv, "n:t:sml")) != -1) {
+  bool print_hash = false;
+  while ((optchar = getopt(argc, argv, "n:t:smlr:d")) != -1) {
     switch (optchar) {
     case 'n':
       selected_test = atoi(optarg);
       break;
+    case 'd':
+      print_hash = true;
+      break;
+    case 'r':
+      // -r file replays the binary rotation trace in the provided file
+      retval = replay_trace(optarg, print_hash) ? EXIT_SUCCESS : EXIT_FAILURE;
+      goto cleanup;
     case 't':
       // -t file runs functional tests in the provided file
       parse_and_run_tests(optarg, selected_test);
@@ -100,6 +109,8 @@ void print_usage(const char* const argv_0) {
           "\t -l Run a sample large (1s) rotation operation\n"
           "\t    (note: the provided -[s/m/l] options only test performance and NOT correctness.)\n"
           "\t -t tests/default\tRun alltests in the testfile tests/default\n"
-          "\t -n 1 -t tests/default\tRun test 1 in the testfile tests/default\n",
+          "\t -n 1 -t tests/default\tRun test 1 in the testfile tests/default\n"
+          "\t -r trace\tReplay the binary rotation trace in the file trace\n"
+          "\t -d -r trace\tReplay trace and print a hash of the final bit array\n",
           argv_0);
 }
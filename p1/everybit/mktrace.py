@@ -0,0 +1,36 @@
+#!/usr/bin/python
+
+"""Generates a synthetic binary rotation trace for everybit -r.
+
+Usage: mktrace.py out_file bit_sz num_ops [seed]
+
+The trace is a trace_header_t (see tests.h) followed by num_ops
+trace_record_t entries, all little-endian.
+"""
+
+import random
+import struct
+import sys
+
+TRACE_MAGIC = b'EVBTRC01'
+
+
+def main(argv):
+  if len(argv) not in (4, 5):
+    sys.stderr.write(__doc__)
+    return 1
+  out_file, bit_sz, num_ops = argv[1], int(argv[2]), int(argv[3])
+  seed = int(argv[4]) if len(argv) == 5 else 6172
+  rng = random.Random(seed)
+  with open(out_file, 'wb') as f:
+    f.write(struct.pack('<8sQQQ', TRACE_MAGIC, bit_sz, seed, num_ops))
+    for _ in range(num_ops):
+      bit_offset = rng.randrange(bit_sz)
+      bit_length = rng.randrange(bit_sz - bit_offset + 1)
+      amount = rng.randrange(-2 * bit_length - 1, 2 * bit_length + 2)
+      f.write(struct.pack('<QQq', bit_offset, bit_length, amount))
+  return 0
+
+
+if __name__ == '__main__':
+  sys.exit(main(sys.argv))
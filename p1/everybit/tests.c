@@ -21,12 +21,18 @@
  **/
 #define _GNU_SOURCE
 #include <assert.h>
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include "./bitarray.h"
 #include "./ktiming.h"
@@ -52,6 +58,13 @@ void testutil_rotate(const size_t bit_offset,
                      const size_t bit_length,
                      const ssize_t bit_right_shift_amount);
 
+// Rotates test_bitarray in place by way of a file: writes it to a temporary
+// file, rotates that with bitarray_file_rotate and reads the result back.
+// Requires that test_bitarray is not NULL.
+void testutil_file_rotate(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_shift_amount);
+
 // Checks that the rotation is valid given the size of test_bitarray.
 // Causes a test suite failure if the input is invalid.
 void testutil_require_valid_input(const size_t bit_offset,
@@ -79,6 +92,31 @@ static void testutil_expect_internal(const char* const bitstring,
                                      const char* const func_name,
                                      const int line);
 
+// Round-trips count pseudorandom values generated from seed through raw
+// fields and through each variable-length code, on a bit stream that starts
+// at an unaligned offset.  Outputs FAIL or PASS as appropriate.
+static void testutil_codec_roundtrip(const size_t count,
+                                     const unsigned int seed,
+                                     const char* const func_name,
+                                     const int line);
+
+// Rotates count pseudorandom bit arrays generated from seed, of assorted
+// sizes, with one bitarray_rotate_many call, and checks each against a copy
+// rotated by bitarray_rotate.  Outputs FAIL or PASS as appropriate.
+static void testutil_rotate_many(const size_t count,
+                                 const unsigned int seed,
+                                 const char* const func_name,
+                                 const int line);
+
+// Allocates count pseudorandom bit arrays generated from seed from an arena,
+// over two rounds separated by bitarray_arena_reset, and checks that each is
+// zero-filled and rotates exactly like a copy from bitarray_new.  Outputs
+// FAIL or PASS as appropriate.
+static void testutil_arena(const size_t count,
+                           const unsigned int seed,
+                           const char* const func_name,
+                           const int line);
+
 // Converts a character into a boolean.  The character '1' converts to true;
 // the character '0' converts to false.
 static bool boolfromchar(const char c);
@@ -248,6 +286,45 @@ void testutil_rotate(const size_t bit_offset,
   }
 }
 
+void testutil_file_rotate(const size_t bit_offset,
+                          const size_t bit_length,
+                          const ssize_t bit_right_shift_amount) {
+  assert(test_bitarray != NULL);
+  const size_t bit_sz = bitarray_get_bit_sz(test_bitarray);
+  const size_t byte_sz = (bit_sz + 7) / 8;
+  unsigned char* const bytes = calloc(1, byte_sz);
+  for (size_t i = 0; i < bit_sz; i++) {
+    bytes[i / 8] |= bitarray_get(test_bitarray, i) << (i % 8);
+  }
+
+  char path[] = "/tmp/everybit.XXXXXX";
+  const int fd = mkstemp(path);
+  assert(fd >= 0);
+  FILE* const f = fdopen(fd, "r+b");
+  fwrite(bytes, 1, byte_sz, f);
+  fflush(f);
+
+  if (bitarray_file_rotate(path, bit_offset, bit_length,
+                           bit_right_shift_amount) != 0) {
+    perror("bitarray_file_rotate");
+  }
+
+  rewind(f);
+  fread(bytes, 1, byte_sz, f);
+  for (size_t i = 0; i < bit_sz; i++) {
+    bitarray_set(test_bitarray, i, (bytes[i / 8] >> (i % 8)) & 1);
+  }
+  fclose(f);
+  unlink(path);
+  free(bytes);
+
+  if (test_verbose) {
+    bitarray_fprint(stdout, test_bitarray);
+    fprintf(stdout, " file rotate off=%zu, len=%zu, amnt=%zd\n",
+            bit_offset, bit_length, bit_right_shift_amount);
+  }
+}
+
 void testutil_require_valid_input(const size_t bit_offset,
                                   const size_t bit_length,
                                   const ssize_t bit_right_shift_amount,
@@ -319,6 +396,194 @@ int timed_rotation(const double time_limit_seconds) {
   return tier_num - 1;
 }
 
+// Returns a pseudorandom 64-bit value whose magnitude is also random, so
+// that codes are exercised across all lengths.
+static uint64_t testutil_rand64() {
+  const uint64_t bits = ((uint64_t)rand() << 62) ^ ((uint64_t)rand() << 31) ^
+                        (uint64_t)rand();
+  return bits >> (rand() % 64);
+}
+
+static void testutil_codec_roundtrip(const size_t count,
+                                     const unsigned int seed,
+                                     const char* const func_name,
+                                     const int line) {
+  // Rice values are kept below 2^12 with k = 5, so a value takes at most 64
+  // raw bits, 127 gamma bits, 134 Rice bits and 80 varint bits.
+  const size_t rice_k = 5;
+  const size_t bit_offset = 3;
+  const size_t bit_sz = bit_offset + (64 + 127 + 134 + 80) * count;
+  bitarray_t* const bitarray = bitarray_new(bit_sz);
+  assert(bitarray != NULL);
+
+  uint64_t* const values = malloc(4 * count * sizeof(uint64_t));
+  uint64_t* const decoded = malloc(4 * count * sizeof(uint64_t));
+  size_t* const widths = malloc(count * sizeof(size_t));
+  uint64_t* const raw = values;
+  uint64_t* const gamma = values + count;
+  uint64_t* const rice = values + 2 * count;
+  uint64_t* const varint = values + 3 * count;
+
+  srand(seed);
+  for (size_t i = 0; i < count; i++) {
+    widths[i] = rand() % 65;
+    raw[i] = testutil_rand64() & (widths[i] == 64 ? ~0ULL
+                                                  : (1ULL << widths[i]) - 1);
+    gamma[i] = testutil_rand64() | 1;
+    rice[i] = rand() % (1 << 12);
+    varint[i] = testutil_rand64();
+  }
+
+  bitwriter_t writer;
+  bitwriter_init(&writer, bitarray, bit_offset);
+  for (size_t i = 0; i < count; i++) {
+    bitwriter_put(&writer, raw[i], widths[i]);
+  }
+  bitwriter_put_gamma(&writer, gamma, count);
+  bitwriter_put_rice(&writer, rice, count, rice_k);
+  bitwriter_put_varint(&writer, varint, count);
+  const size_t end = bitwriter_flush(&writer);
+
+  bitreader_t reader;
+  bitreader_init(&reader, bitarray, bit_offset);
+  for (size_t i = 0; i < count; i++) {
+    decoded[i] = bitreader_get(&reader, widths[i]);
+  }
+  bitreader_get_gamma(&reader, decoded + count, count);
+  bitreader_get_rice(&reader, decoded + 2 * count, count, rice_k);
+  bitreader_get_varint(&reader, decoded + 3 * count, count);
+
+  if (reader.bit_index != end) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Read %zu bits but wrote %zu.",
+                        reader.bit_index - bit_offset, end - bit_offset);
+  } else if (memcmp(values, decoded, 4 * count * sizeof(uint64_t)) != 0) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Decoded values differ.");
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+
+  free(widths);
+  free(decoded);
+  free(values);
+  bitarray_free(bitarray);
+}
+
+static void testutil_rotate_many(const size_t count,
+                                 const unsigned int seed,
+                                 const char* const func_name,
+                                 const int line) {
+  bitarray_t** const arrays = malloc(count * sizeof(bitarray_t*));
+  bitarray_t** const expected = malloc(count * sizeof(bitarray_t*));
+  rot_op_t* const ops = malloc(count * sizeof(rot_op_t));
+
+  srand(seed);
+  for (size_t i = 0; i < count; i++) {
+    // Mostly arrays that fit the batched kernel, and some that do not.
+    const size_t bit_sz = 1 + rand() % 700;
+    arrays[i] = bitarray_new(bit_sz);
+    expected[i] = bitarray_new(bit_sz);
+    assert(arrays[i] != NULL && expected[i] != NULL);
+    for (size_t j = 0; j < bit_sz; j++) {
+      const bool bit = rand() & 1;
+      bitarray_set(arrays[i], j, bit);
+      bitarray_set(expected[i], j, bit);
+    }
+    ops[i].bit_offset = rand() % bit_sz;
+    ops[i].bit_length = rand() % (bit_sz - ops[i].bit_offset + 1);
+    ops[i].bit_right_amount = rand() % 2001 - 1000;
+    bitarray_rotate(expected[i], ops[i].bit_offset, ops[i].bit_length,
+                    ops[i].bit_right_amount);
+  }
+
+  bitarray_rotate_many(arrays, ops, count);
+
+  size_t mismatch = count;
+  for (size_t i = 0; i < count && mismatch == count; i++) {
+    for (size_t j = 0; j < bitarray_get_bit_sz(arrays[i]); j++) {
+      if (bitarray_get(arrays[i], j) != bitarray_get(expected[i], j)) {
+        mismatch = i;
+        break;
+      }
+    }
+  }
+  if (mismatch != count) {
+    TEST_FAIL_WITH_NAME(func_name, line,
+                        " Array %zu (sz=%zu, off=%zu, len=%zu, amnt=%zd)"
+                        " differs.", mismatch,
+                        bitarray_get_bit_sz(arrays[mismatch]),
+                        ops[mismatch].bit_offset, ops[mismatch].bit_length,
+                        ops[mismatch].bit_right_amount);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    bitarray_free(arrays[i]);
+    bitarray_free(expected[i]);
+  }
+  free(ops);
+  free(expected);
+  free(arrays);
+}
+
+static void testutil_arena(const size_t count,
+                           const unsigned int seed,
+                           const char* const func_name,
+                           const int line) {
+  // Small blocks, so that some arrays need blocks of their own.
+  bitarray_arena_t* const arena = bitarray_arena_new(4096);
+  assert(arena != NULL);
+  bitarray_t** const arrays = malloc(count * sizeof(bitarray_t*));
+  bitarray_t** const expected = malloc(count * sizeof(bitarray_t*));
+  const char* bad = NULL;
+
+  srand(seed);
+  for (int round = 0; round < 2 && bad == NULL; round++) {
+    for (size_t i = 0; i < count; i++) {
+      const size_t bit_sz = 1 + rand() % 40000;
+      arrays[i] = bitarray_arena_alloc(arena, bit_sz);
+      expected[i] = bitarray_new(bit_sz);
+      assert(arrays[i] != NULL && expected[i] != NULL);
+      for (size_t j = 0; j < bit_sz; j++) {
+        if (bitarray_get(arrays[i], j)) {
+          bad = "arena bit array is not zero-filled";
+        }
+      }
+      bitarray_randfill(arrays[i]);
+      for (size_t j = 0; j < bit_sz; j++) {
+        bitarray_set(expected[i], j, bitarray_get(arrays[i], j));
+      }
+      const size_t offset = rand() % bit_sz;
+      const size_t length = rand() % (bit_sz - offset + 1);
+      const ssize_t amount = rand() % 2001 - 1000;
+      bitarray_rotate(arrays[i], offset, length, amount);
+      bitarray_rotate(expected[i], offset, length, amount);
+    }
+    for (size_t i = 0; i < count; i++) {
+      for (size_t j = 0; j < bitarray_get_bit_sz(arrays[i]); j++) {
+        if (bitarray_get(arrays[i], j) != bitarray_get(expected[i], j)) {
+          bad = "arena bit array content";
+          break;
+        }
+      }
+      // Freeing an arena bit array must leave it alone.
+      bitarray_free(arrays[i]);
+      bitarray_free(expected[i]);
+    }
+    bitarray_arena_reset(arena);
+  }
+
+  if (bad != NULL) {
+    TEST_FAIL_WITH_NAME(func_name, line, " Incorrect %s.", bad);
+  } else {
+    TEST_PASS_WITH_NAME(func_name, line);
+  }
+
+  free(expected);
+  free(arrays);
+  bitarray_arena_delete(arena);
+}
+
 static bool boolfromchar(const char c) {
   assert(c == '0' || c == '1');
   return c == '1';
@@ -390,6 +655,48 @@ void parse_and_run_tests(const char* filename, int selected_test) {
         testutil_rotate(offset, length, amount);
       }
       break;
+    case 'f':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t offset = (size_t) NEXT_ARG_LONG();
+        size_t length = (size_t) NEXT_ARG_LONG();
+        ssize_t amount = (ssize_t) NEXT_ARG_LONG();
+        testutil_require_valid_input(offset, length, amount, filename, line);
+        testutil_file_rotate(offset, length, amount);
+      }
+      break;
+    case 'c':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t count = (size_t) NEXT_ARG_LONG();
+        unsigned int seed = (unsigned int) NEXT_ARG_LONG();
+        testutil_codec_roundtrip(count, seed, filename, line);
+      }
+      break;
+    case 'b':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t count = (size_t) NEXT_ARG_LONG();
+        unsigned int seed = (unsigned int) NEXT_ARG_LONG();
+        testutil_rotate_many(count, seed, filename, line);
+      }
+      break;
+    case 'a':
+      if (!ready_to_run) {
+        continue;
+      }
+      {
+        size_t count = (size_t) NEXT_ARG_LONG();
+        unsigned int seed = (unsigned int) NEXT_ARG_LONG();
+        testutil_arena(count, seed, filename, line);
+      }
+      break;
     default:
       fprintf(stderr, "Unknown command %s", buf);
     }
@@ -399,6 +706,126 @@ void parse_and_run_tests(const char* filename, int selected_test) {
   fprintf(stderr, "Done testing file %s.\n", filename);
 }
 
+static int compare_uint64(const void* a, const void* b) {
+  const uint64_t x = *(const uint64_t*)a;
+  const uint64_t y = *(const uint64_t*)b;
+  return (x > y) - (x < y);
+}
+
+// Hashes the content of a bit array with FNV-1a over its 64-bit words, the
+// last one zero-padded.
+static uint64_t bitarray_hash(const bitarray_t* const bitarray) {
+  const size_t bit_sz = bitarray_get_bit_sz(bitarray);
+  bitreader_t reader;
+  bitreader_init(&reader, bitarray, 0);
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < bit_sz; i += 64) {
+    const size_t n = bit_sz - i < 64 ? bit_sz - i : 64;
+    hash = (hash ^ bitreader_get(&reader, n)) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Converts a little-endian trace field to host byte order.
+static inline uint64_t trace_le64(const uint64_t v) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return __builtin_bswap64(v);
+#else
+  return v;
+#endif
+}
+
+bool replay_trace(const char* filename, bool print_hash) {
+  test_verbose = false;
+  const int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Error opening file.\n");
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(trace_header_t)) {
+    fprintf(stderr, "Trace %s is too short.\n", filename);
+    close(fd);
+    return false;
+  }
+
+  // Map the whole trace and read records straight out of the mapping.
+  void* const map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("mmap");
+    return false;
+  }
+  madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+  const trace_header_t* const header = map;
+  const trace_record_t* const records =
+      (const trace_record_t*)((const char*)map + sizeof(trace_header_t));
+  const uint64_t bit_sz = trace_le64(header->bit_sz);
+  const uint64_t seed = trace_le64(header->seed);
+  const uint64_t num_ops = trace_le64(header->num_ops);
+  // Bound num_ops by the records that fit before multiplying, so that a corrupt count can't
+  // wrap the size check around.
+  const size_t max_ops = ((size_t)st.st_size - sizeof(trace_header_t)) / sizeof(trace_record_t);
+  if (memcmp(header->magic, TRACE_MAGIC, sizeof(header->magic)) != 0 || num_ops > max_ops ||
+      (size_t)st.st_size != sizeof(trace_header_t) + num_ops * sizeof(trace_record_t) ||
+      bit_sz == 0) {
+    fprintf(stderr, "Trace %s is malformed.\n", filename);
+    munmap(map, st.st_size);
+    return false;
+  }
+
+  testutil_newrand(bit_sz, (unsigned int)seed);
+  uint64_t* const latencies = malloc((num_ops + 1) * sizeof(uint64_t));
+  assert(latencies != NULL);
+
+  size_t done = 0;
+  uint64_t bits_rotated = 0;
+  const clockmark_t start_time = ktiming_getmark();
+  for (; done < num_ops; done++) {
+    const uint64_t bit_offset = trace_le64(records[done].bit_offset);
+    const uint64_t bit_length = trace_le64(records[done].bit_length);
+    const int64_t bit_right_amount =
+        (int64_t)trace_le64((uint64_t)records[done].bit_right_amount);
+    if (bit_offset > bit_sz || bit_length > bit_sz - bit_offset) {
+      fprintf(stderr, "Trace %s: rotation %zu is out of range.\n", filename,
+              done);
+      break;
+    }
+    const clockmark_t op_start = ktiming_getmark();
+    bitarray_rotate(test_bitarray, bit_offset, bit_length, bit_right_amount);
+    const clockmark_t op_end = ktiming_getmark();
+    latencies[done] = ktiming_diff_usec(&op_start, &op_end);
+    bits_rotated += bit_length;
+  }
+  const clockmark_t end_time = ktiming_getmark();
+  const double seconds =
+      ktiming_diff_usec(&start_time, &end_time) / 1000000000.0;
+
+  qsort(latencies, done, sizeof(uint64_t), compare_uint64);
+  printf("---- RESULTS ----\n");
+  printf("Replayed %zu of %" PRIu64 " rotations on %" PRIu64 " bits in %.6fs\n",
+         done, num_ops, bit_sz, seconds);
+  if (seconds > 0) {
+    printf("Throughput: %.0f rotations/s, %.3f Gbit/s\n", done / seconds,
+           bits_rotated / seconds / 1e9);
+  }
+  if (done > 0) {
+    printf("Latency: p50 %" PRIu64 "ns, p99 %" PRIu64 "ns\n",
+           latencies[done / 2], latencies[done * 99 / 100]);
+  }
+  if (print_hash) {
+    printf("Content hash: %016" PRIx64 "\n", bitarray_hash(test_bitarray));
+  }
+  printf("---- END RESULTS ----\n");
+
+  free(latencies);
+  munmap(map, st.st_size);
+  bitarray_free(test_bitarray);
+  test_bitarray = NULL;
+  return done == num_ops;
+}
+
 // Local Variables:
 // mode: C
 // fill-column: 100
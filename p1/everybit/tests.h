@@ -25,6 +25,7 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 
 #include <sys/types.h>
@@ -32,6 +33,31 @@
 #include "./bitarray.h"
 
 
+// ********************************* Types **********************************
+
+// A binary rotation trace is a trace_header_t followed by num_ops trace_record_t, all
+// little-endian as mktrace.py writes them; replay_trace decodes every field explicitly, so
+// traces replay the same on hosts of either byte order.  Records are replayed in order
+// against a bit array of bit_sz bits, filled as testutil_newrand would fill it for seed.
+
+// Identifies a file as a binary rotation trace.
+#define TRACE_MAGIC "EVBTRC01"
+
+typedef struct {
+  char magic[8];
+  uint64_t bit_sz;
+  uint64_t seed;
+  uint64_t num_ops;
+} trace_header_t;
+
+// One rotation; the fields have the same meaning as the arguments of
+// bitarray_rotate.
+typedef struct {
+  uint64_t bit_offset;
+  uint64_t bit_length;
+  int64_t bit_right_amount;
+} trace_record_t;
+
 // ******************************* Prototypes *******************************
 
 // Will run increasingly larger test cases, until a test case takes longer
@@ -42,5 +68,11 @@ int timed_rotation(const double time_limit_seconds);
 // Runs the testsuite specified in a given file.
 void parse_and_run_tests(const char* filename, int min_test);
 
+// Replays the binary rotation trace in a given file, and reports throughput
+// and per-rotation latency.  If print_hash is set, also reports a hash of
+// the final bit array content.  Returns false if the trace is unreadable or
+// malformed.
+bool replay_trace(const char* filename, bool print_hash);
+
 #endif  // TESTS_H
 
@@ -0,0 +1,107 @@
+#include "arena.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define ARENA_ALIGN 16
+#define ARENA_ALIGN_UP(x) (((x) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+// Blocks are followed directly by their data.
+#define ARENA_BLOCK_HEADER_SIZE ARENA_ALIGN_UP(sizeof(ArenaBlock))
+
+static inline char* ArenaBlock_data(ArenaBlock* block) {
+  return (char*)block + ARENA_BLOCK_HEADER_SIZE;
+}
+
+static ArenaBlock* ArenaBlock_new(size_t size) {
+  ArenaBlock* block = malloc(ARENA_BLOCK_HEADER_SIZE + size);
+  if (block == NULL) {
+    return NULL;
+  }
+  *block = (ArenaBlock){.next = NULL, .size = size, .used = 0};
+  return block;
+}
+
+Arena* Arena_new(size_t block_size) {
+  Arena* arena = malloc(sizeof(Arena));
+  if (arena == NULL) {
+    return NULL;
+  }
+  *arena = (Arena){
+      .block_size = block_size == 0 ? ARENA_BLOCK_SIZE : block_size,
+      .blocks = NULL,
+      .current = NULL,
+  };
+  return arena;
+}
+
+void Arena_delete(Arena* arena) {
+  if (arena == NULL) return;
+
+  ArenaBlock* block = arena->blocks;
+  while (block != NULL) {
+    ArenaBlock* next = block->next;
+    free(block);
+    block = next;
+  }
+  free(arena);
+}
+
+// Moves on to the next block that can hold sz bytes, appending a new one if
+// none of the remaining blocks is large enough.
+static void* Arena_allocSlow(Arena* arena, size_t sz) {
+  ArenaBlock* prev = arena->current;
+  ArenaBlock* block = prev == NULL ? arena->blocks : prev->next;
+  while (block != NULL && block->size < sz) {
+    prev = block;
+    block = block->next;
+  }
+
+  if (block == NULL) {
+    block = ArenaBlock_new(sz > arena->block_size ? sz : arena->block_size);
+    if (block == NULL) {
+      return NULL;
+    }
+    if (prev == NULL) {
+      arena->blocks = block;
+    } else {
+      block->next = prev->next;
+      prev->next = block;
+    }
+  }
+
+  arena->current = block;
+  block->used = sz;
+  return ArenaBlock_data(block);
+}
+
+void* Arena_alloc(Arena* arena, size_t sz) {
+  assert(arena != NULL);
+  sz = ARENA_ALIGN_UP(sz);
+
+  ArenaBlock* block = arena->current;
+  if (block != NULL && block->size - block->used >= sz) {
+    void* ptr = ArenaBlock_data(block) + block->used;
+    block->used += sz;
+    return ptr;
+  }
+  return Arena_allocSlow(arena, sz);
+}
+
+void Arena_reset(Arena* arena) {
+  for (ArenaBlock* block = arena->blocks; block != NULL; block = block->next) {
+    block->used = 0;
+  }
+  arena->current = arena->blocks;
+}
+
+void Arena_rewind(Arena* arena, ArenaMark mark) {
+  if (mark.block == NULL) {
+    Arena_reset(arena);
+    return;
+  }
+  // Blocks after mark.block are reset when Arena_allocSlow moves on to them.
+  arena->current = mark.block;
+  mark.block->used = mark.used;
+}
@@ -0,0 +1,64 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+// Default size of each block an Arena carves allocations out of.
+#define ARENA_BLOCK_SIZE (1 << 20)
+
+// Bump allocator for memory that dies at the same time. CollisionWorld's frame
+// arena holds the frame's LineGeoms, the LinePgs handed to the quadtree and the
+// solver's batching arrays; each worker arena holds the scratch arrays of the
+// broad phase block being tested, rewound after each block. Allocations are
+// never freed individually; Arena_reset releases everything at once and keeps
+// the blocks around for the next frame.
+struct ArenaBlock {
+  struct ArenaBlock* next;
+  size_t size;
+  size_t used;
+};
+typedef struct ArenaBlock ArenaBlock;
+
+struct Arena {
+  size_t block_size;
+  // All blocks, in allocation order. Blocks before current are full.
+  ArenaBlock* blocks;
+  ArenaBlock* current;
+};
+typedef struct Arena Arena;
+
+// A point in an arena's allocations to rewind to.
+struct ArenaMark {
+  ArenaBlock* block;
+  size_t used;
+};
+typedef struct ArenaMark ArenaMark;
+
+// Returns a new, empty arena. block_size of 0 means ARENA_BLOCK_SIZE.
+Arena* Arena_new(size_t block_size);
+
+// Frees the arena and every allocation made from it.
+void Arena_delete(Arena* arena);
+
+// Returns sz bytes of uninitialized, 16-byte aligned memory that stays valid
+// until the next Arena_reset or Arena_delete.
+void* Arena_alloc(Arena* arena, size_t sz);
+
+// Invalidates every allocation made from the arena, keeping its memory.
+void Arena_reset(Arena* arena);
+
+// Returns the arena's current position, for Arena_rewind.
+static inline ArenaMark Arena_mark(const Arena* arena) {
+  return (ArenaMark){
+      .block = arena->current,
+      .used = arena->current == NULL ? 0 : arena->current->used,
+  };
+}
+
+// Invalidates every allocation made since mark was taken, so that scratch
+// arrays of a loop body can be reused by the next iteration. Nothing else may
+// allocate from the arena between the two calls, so in parallel code both
+// must run on the same strand with no spawn in between.
+void Arena_rewind(Arena* arena, ArenaMark mark);
+
+#endif  // ARENA_H_
@@ -0,0 +1,236 @@
+// Benchmark driver for the screensaver. Runs each scene for a number of frames
+// and reports frames per second, the median time of every phase of a frame and
+// the pair test counts, as CSV or JSON.
+
+#include <getopt.h>
+#include <glob.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "./collision_world.h"
+#include "./fasttime.h"
+#include "./line_demo.h"
+
+#define BENCH_DEFAULT_FRAMES 100
+#define BENCH_DEFAULT_INPUTS "input/*"
+
+// Results of running one scene.
+struct BenchResult {
+  const char* path;
+  unsigned int numOfLines;
+  unsigned int numFrames;
+  double seconds;
+  // Median of each phase over all frames.
+  PhaseTimes median;
+  uint64_t pairsTested;
+  uint64_t pairsRejected;
+  unsigned int lineWallCollisions;
+  unsigned int lineLineCollisions;
+};
+typedef struct BenchResult BenchResult;
+
+static int compareDouble(const void* a, const void* b) {
+  const double x = *(const double*)a;
+  const double y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// Returns the median of the n values, reordering them.
+static double median(double* values, unsigned int n) {
+  qsort(values, n, sizeof(double), compareDouble);
+  return n % 2 == 1 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+}
+
+// Offset of a phase within PhaseTimes.
+#define PHASE(name) offsetof(PhaseTimes, name)
+
+// Returns the median over the n frames of the phase at offset phase, using
+// scratch for n values.
+static double medianPhase(const PhaseTimes* frames, unsigned int n,
+                          size_t phase, double* scratch) {
+  for (unsigned int i = 0; i < n; i++) {
+    scratch[i] = *(const double*)((const char*)&frames[i] + phase);
+  }
+  return median(scratch, n);
+}
+
+static BenchResult benchScene(char* path, unsigned int numFrames,
+                              BroadPhase broadPhase, bool soaFlag) {
+  LineDemo* lineDemo = LineDemo_new();
+  LineDemo_setInputFile(path);
+  LineDemo_initLine(lineDemo);
+  if (soaFlag) {
+    LineDemo_useSoA(lineDemo);
+  }
+  LineDemo_setBroadPhase(lineDemo, broadPhase);
+  CollisionWorld* collisionWorld = lineDemo->collisionWorld;
+
+  PhaseTimes* frames = malloc(numFrames * sizeof(PhaseTimes));
+  const fasttime_t start_time = gettime();
+  for (unsigned int i = 0; i < numFrames; i++) {
+    CollisionWorld_updateLines(collisionWorld);
+    frames[i] = CollisionWorld_getPhaseTimes(collisionWorld);
+  }
+  const fasttime_t end_time = gettime();
+
+  BenchResult result = {
+      .path = path,
+      .numOfLines = CollisionWorld_getNumOfLines(collisionWorld),
+      .numFrames = numFrames,
+      .seconds = tdiff(start_time, end_time),
+      .pairsTested = CollisionWorld_getNumPairsTested(collisionWorld),
+      .pairsRejected = CollisionWorld_getNumPairsRejected(collisionWorld),
+      .lineWallCollisions =
+          CollisionWorld_getNumLineWallCollisions(collisionWorld),
+      .lineLineCollisions =
+          CollisionWorld_getNumLineLineCollisions(collisionWorld),
+  };
+
+  double* values = malloc(numFrames * sizeof(double));
+  result.median = (PhaseTimes){
+      .load = medianPhase(frames, numFrames, PHASE(load), values),
+      .build = medianPhase(frames, numFrames, PHASE(build), values),
+      .traverse = medianPhase(frames, numFrames, PHASE(traverse), values),
+      .sort = medianPhase(frames, numFrames, PHASE(sort), values),
+      .solve = medianPhase(frames, numFrames, PHASE(solve), values),
+      .position = medianPhase(frames, numFrames, PHASE(position), values),
+      .wall = medianPhase(frames, numFrames, PHASE(wall), values),
+  };
+
+  free(values);
+  free(frames);
+  LineDemo_delete(lineDemo);
+  return result;
+}
+
+static void printCsvHeader() {
+  printf("input,lines,frames,seconds,fps,load_ms,build_ms,traverse_ms,"
+         "sort_ms,solve_ms,position_ms,wall_ms,pairs_tested,pairs_rejected,"
+         "line_wall_collisions,line_line_collisions\n");
+}
+
+static void printCsv(const BenchResult* r) {
+  printf("%s,%u,%u,%f,%f,%f,%f,%f,%f,%f,%f,%f,%" PRIu64 ",%" PRIu64
+         ",%u,%u\n",
+         r->path, r->numOfLines, r->numFrames, r->seconds,
+         r->numFrames / r->seconds, 1e3 * r->median.load, 1e3 * r->median.build,
+         1e3 * r->median.traverse, 1e3 * r->median.sort,
+         1e3 * r->median.solve, 1e3 * r->median.position,
+         1e3 * r->median.wall, r->pairsTested, r->pairsRejected,
+         r->lineWallCollisions, r->lineLineCollisions);
+}
+
+static void printJson(const BenchResult* r, bool last) {
+  printf("  {\"input\": \"%s\", \"lines\": %u, \"frames\": %u, "
+         "\"seconds\": %f, \"fps\": %f,\n",
+         r->path, r->numOfLines, r->numFrames, r->seconds,
+         r->numFrames / r->seconds);
+  printf("   \"median_ms\": {\"load\": %f, \"build\": %f, \"traverse\": %f, "
+         "\"sort\": %f, \"solve\": %f, \"position\": %f, \"wall\": %f},\n",
+         1e3 * r->median.load, 1e3 * r->median.build, 1e3 * r->median.traverse,
+         1e3 * r->median.sort, 1e3 * r->median.solve,
+         1e3 * r->median.position, 1e3 * r->median.wall);
+  printf("   \"pairs_tested\": %" PRIu64 ", \"pairs_rejected\": %" PRIu64
+         ", \"line_wall_collisions\": %u, \"line_line_collisions\": %u}%s\n",
+         r->pairsTested, r->pairsRejected, r->lineWallCollisions,
+         r->lineLineCollisions, last ? "" : ",");
+}
+
+static void usage(char* program) {
+  printf("Usage: %s [-n frames] [-f csv|json] [-b engine] [-s] "
+         "[inputfile...]\n",
+         program);
+  printf("  -n : frames to run each scene for (%d)\n", BENCH_DEFAULT_FRAMES);
+  printf("  -f : output format, csv (default) or json\n");
+  printf("  -b : broad phase, quadtree (default), grid, sweep or morton\n");
+  printf("  -s : store lines as structure of arrays (SIMD updates)\n");
+  printf("Runs every regular file matching %s if no input files are given.\n",
+         BENCH_DEFAULT_INPUTS);
+}
+
+int main(int argc, char* argv[]) {
+  int optchar;
+  unsigned int numFrames = BENCH_DEFAULT_FRAMES;
+  bool jsonFlag = false;
+  bool soaFlag = false;
+  BroadPhase broadPhase = BROAD_PHASE_QUADTREE;
+
+  while ((optchar = getopt(argc, argv, "n:f:b:sh")) != -1) {
+    switch (optchar) {
+      case 'n':
+        numFrames = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      case 'f':
+        jsonFlag = strcmp(optarg, "json") == 0;
+        break;
+      case 'b':
+        if (strcmp(optarg, "quadtree") == 0) {
+          broadPhase = BROAD_PHASE_QUADTREE;
+        } else if (strcmp(optarg, "grid") == 0) {
+          broadPhase = BROAD_PHASE_GRID;
+        } else if (strcmp(optarg, "sweep") == 0) {
+          broadPhase = BROAD_PHASE_SWEEP;
+        } else if (strcmp(optarg, "morton") == 0) {
+          broadPhase = BROAD_PHASE_MORTON;
+        } else {
+          fprintf(stderr, "Ignoring unrecognized broad phase: %s\n", optarg);
+        }
+        break;
+      case 's':
+        soaFlag = true;
+        break;
+      default:
+        usage(argv[0]);
+        exit(-1);
+    }
+  }
+
+  // Collect the scenes to run.
+  glob_t inputs = {0};
+  char** regularInputs = NULL;
+  char** paths = argv + optind;
+  size_t numPaths = argc - optind;
+  if (numPaths == 0) {
+    if (glob(BENCH_DEFAULT_INPUTS, 0, NULL, &inputs) != 0) {
+      fprintf(stderr, "No inputs match %s\n", BENCH_DEFAULT_INPUTS);
+      exit(1);
+    }
+    // Keep only the regular files.
+    regularInputs = malloc(inputs.gl_pathc * sizeof(char*));
+    numPaths = 0;
+    for (size_t i = 0; i < inputs.gl_pathc; i++) {
+      struct stat st;
+      if (stat(inputs.gl_pathv[i], &st) == 0 && S_ISREG(st.st_mode)) {
+        regularInputs[numPaths++] = inputs.gl_pathv[i];
+      }
+    }
+    paths = regularInputs;
+  }
+
+  if (jsonFlag) {
+    printf("[\n");
+  } else {
+    printCsvHeader();
+  }
+  for (size_t i = 0; i < numPaths; i++) {
+    const BenchResult result =
+        benchScene(paths[i], numFrames, broadPhase, soaFlag);
+    if (jsonFlag) {
+      printJson(&result, i + 1 == numPaths);
+    } else {
+      printCsv(&result);
+    }
+    fflush(stdout);
+  }
+  if (jsonFlag) {
+    printf("]\n");
+  }
+
+  free(regularInputs);
+  globfree(&inputs);
+  return 0;
+}
@@ -24,16 +24,31 @@
 #include "./collision_world.h"
 
 #include <assert.h>
+#include <cilk/cilk.h>
+#include <cilk/cilk_api.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
+#include "./fasttime.h"
+#include "./fixed_point.h"
+#include "./instrument.h"
 #include "./intersection_detection.h"
 #include "./intersection_event_list.h"
 #include "./line.h"
+#include "grid.h"
+#include "linear_quadtree.h"
 #include "quadtree.h"
+#include "sweep_and_prune.h"
 #include "vec.h"
 
+// Frames with fewer events than this run the collision solver serially.
+#define SOLVE_PARALLEL_THRESHOLD 1024
+// Conflict-free batches smaller than this are solved serially.
+#define SOLVE_MIN_BATCH 64
+
 CollisionWorld* CollisionWorld_new(const unsigned int capacity) {
   assert(capacity > 0);
 
@@ -44,17 +59,54 @@ CollisionWorld* CollisionWorld_new(const unsigned int capacity) {
 
   collisionWorld->numLineWallCollisions = 0;
   collisionWorld->numLineLineCollisions = 0;
+  collisionWorld->numPairsRejected = 0;
+  collisionWorld->numPairsTested = 0;
+  collisionWorld->phaseTimes = (PhaseTimes){0};
+  collisionWorld->geom = NULL;
   collisionWorld->timeStep = 0.5;
   collisionWorld->lines = malloc(capacity * sizeof(Line*));
   collisionWorld->numOfLines = 0;
+  collisionWorld->capacity = capacity;
+  collisionWorld->lineBlock = NULL;
+  collisionWorld->lineMapping = NULL;
+  collisionWorld->lineMappingSize = 0;
+  collisionWorld->soa = NULL;
+  collisionWorld->frameArena = Arena_new(0);
+  collisionWorld->broadPhase = BROAD_PHASE_QUADTREE;
+  collisionWorld->quadTree = QuadTree_new();
+  collisionWorld->grid = Grid_new();
+  collisionWorld->sap = SweepAndPrune_new();
+  collisionWorld->lqt = LinearQuadTree_new();
+  collisionWorld->numWorkers = __cilkrts_get_nworkers();
+  collisionWorld->workerArenas =
+      malloc(collisionWorld->numWorkers * sizeof(Arena*));
+  for (unsigned int i = 0; i < collisionWorld->numWorkers; i++) {
+    collisionWorld->workerArenas[i] = Arena_new(0);
+  }
   return collisionWorld;
 }
 
 void CollisionWorld_delete(CollisionWorld* collisionWorld) {
-  for (int i = 0; i < collisionWorld->numOfLines; i++) {
-    free(collisionWorld->lines[i]);
+  if (collisionWorld->lineMapping != NULL) {
+    munmap(collisionWorld->lineMapping, collisionWorld->lineMappingSize);
+  } else if (collisionWorld->lineBlock != NULL) {
+    free(collisionWorld->lineBlock);
+  } else {
+    for (int i = 0; i < collisionWorld->numOfLines; i++) {
+      free(collisionWorld->lines[i]);
+    }
   }
   free(collisionWorld->lines);
+  LineSoA_delete(collisionWorld->soa);
+  Arena_delete(collisionWorld->frameArena);
+  QuadTree_delete(collisionWorld->quadTree);
+  Grid_delete(collisionWorld->grid);
+  SweepAndPrune_delete(collisionWorld->sap);
+  LinearQuadTree_delete(collisionWorld->lqt);
+  for (unsigned int i = 0; i < collisionWorld->numWorkers; i++) {
+    Arena_delete(collisionWorld->workerArenas[i]);
+  }
+  free(collisionWorld->workerArenas);
   free(collisionWorld);
 }
 
@@ -63,26 +115,100 @@ unsigned int CollisionWorld_getNumOfLines(CollisionWorld* collisionWorld) {
 }
 
 void CollisionWorld_addLine(CollisionWorld* collisionWorld, Line* line) {
+  assert(collisionWorld->soa == NULL);
+  assert(collisionWorld->lineBlock == NULL);
+  assert(collisionWorld->numOfLines < collisionWorld->capacity);
+  assert(line->id == collisionWorld->numOfLines);
+  Line_snap(line, collisionWorld->timeStep);
   collisionWorld->lines[collisionWorld->numOfLines] = line;
   collisionWorld->numOfLines++;
 }
 
+void CollisionWorld_addLineBlock(CollisionWorld* collisionWorld, Line* block,
+                                 const unsigned int n) {
+  assert(collisionWorld->soa == NULL);
+  assert(collisionWorld->numOfLines == 0);
+  assert(n <= collisionWorld->capacity);
+  collisionWorld->lineBlock = block;
+  for (unsigned int i = 0; i < n; i++) {
+    assert(block[i].id == i);
+    Line_snap(&block[i], collisionWorld->timeStep);
+    collisionWorld->lines[i] = &block[i];
+  }
+  collisionWorld->numOfLines = n;
+}
+
+void CollisionWorld_addMappedLineBlock(CollisionWorld* collisionWorld,
+                                       Line* block, const unsigned int n,
+                                       void* mapping, size_t mappingSize) {
+  CollisionWorld_addLineBlock(collisionWorld, block, n);
+  collisionWorld->lineMapping = mapping;
+  collisionWorld->lineMappingSize = mappingSize;
+}
+
 Line* CollisionWorld_getLine(CollisionWorld* collisionWorld,
                              const unsigned int index) {
   if (index >= collisionWorld->numOfLines) {
     return NULL;
   }
-  return collisionWorld->lines[index];
+  Line* line = collisionWorld->lines[index];
+  if (collisionWorld->soa != NULL) {
+    LineSoA_loadLine(collisionWorld->soa, index, line);
+  }
+  return line;
+}
+
+void CollisionWorld_enableSoA(CollisionWorld* collisionWorld) {
+  if (collisionWorld->soa != NULL) {
+    return;
+  }
+  collisionWorld->soa = LineSoA_new(collisionWorld->numOfLines);
+  LineSoA_store(collisionWorld->soa, collisionWorld->lines);
+}
+
+void CollisionWorld_setBroadPhase(CollisionWorld* collisionWorld,
+                                  BroadPhase broadPhase) {
+  collisionWorld->broadPhase = broadPhase;
+}
+
+void CollisionWorld_setQuadTreeParams(CollisionWorld* collisionWorld,
+                                      QuadTreeParams params) {
+  QuadTree_setParams(collisionWorld->quadTree, params);
 }
 
 void CollisionWorld_updateLines(CollisionWorld* collisionWorld) {
+  LineSoA* soa = collisionWorld->soa;
+  PhaseTimes* phaseTimes = &collisionWorld->phaseTimes;
+  phaseTimes->load = 0;
+  if (soa != NULL) {
+    // The intersection code works on Line structs, so bring them up to date.
+    // The solver keeps the arrays' velocities current itself.
+    const fasttime_t load_start = gettime();
+    LineSoA_load(soa, collisionWorld->lines);
+    phaseTimes->load = tdiff(load_start, gettime());
+  }
   CollisionWorld_detectIntersection2(collisionWorld);
+  const fasttime_t position_start = gettime();
+  INSTRUMENT_ONLY(const uint64_t position_cycles = Instrument_cycles();)
   CollisionWorld_updatePosition(collisionWorld);
+  const fasttime_t wall_start = gettime();
+  INSTRUMENT_ONLY(const uint64_t wall_cycles = Instrument_cycles();)
   CollisionWorld_lineWallCollision(collisionWorld);
+  INSTRUMENT_ONLY(const uint64_t end_cycles = Instrument_cycles();)
+  const fasttime_t wall_end = gettime();
+  phaseTimes->position = tdiff(position_start, wall_start);
+  phaseTimes->wall = tdiff(wall_start, wall_end);
+  INSTRUMENT_ONLY(
+      Instrument_phase(INSTRUMENT_POSITION, wall_cycles - position_cycles);
+      Instrument_phase(INSTRUMENT_WALL, end_cycles - wall_cycles);)
 }
 
 void CollisionWorld_updatePosition(CollisionWorld* collisionWorld) {
   double t = collisionWorld->timeStep;
+  if (collisionWorld->soa != NULL) {
+    LineSoA_updatePosition(collisionWorld->soa, t);
+    return;
+  }
   for (int i = 0; i < collisionWorld->numOfLines; i++) {
     Line* line = collisionWorld->lines[i];
     line->p1 = Vec_add(line->p1, Vec_multiply(line->velocity, t));
@@ -91,6 +217,11 @@ void CollisionWorld_updatePosition(CollisionWorld* collisionWorld) {
 }
 
 void CollisionWorld_lineWallCollision(CollisionWorld* collisionWorld) {
+  if (collisionWorld->soa != NULL) {
+    collisionWorld->numLineWallCollisions +=
+        LineSoA_lineWallCollision(collisionWorld->soa);
+    return;
+  }
   for (int i = 0; i < collisionWorld->numOfLines; i++) {
     Line* line = collisionWorld->lines[i];
     bool collide = false;
@@ -126,121 +257,462 @@ void CollisionWorld_lineWallCollision(CollisionWorld* collisionWorld) {
   }
 }
 
-void IEL_QT_compute(IntersectionEventList iel, QuadTree* qt, LinePgList* pgl,
-                    CollisionWorld* collisionWorld) {
-  // Check all contained pgs against accumulated pgs
-  if (pgl->head != NULL && qt->contained_sz > 0) {
-    LinePgListNode* cont_nd = qt->contained.head;
-    while (cont_nd != NULL) {
-      LinePgListNode* acc_nd = pgl->head;
-      while (acc_nd != NULL) {
-        Line* l1 = cont_nd->pg->now;
-        Line* l2 = acc_nd->pg->now;
-        if (compareLines(l1, l2) >= 0) {
-          Line* temp = l1;
-          l1 = l2;
-          l2 = temp;
-        }
+// Reducer callbacks for the event list and collision counter filled in by the
+// parallel quadtree traversal. Lists are concatenated in serial order, so the
+// result is the same list the serial traversal would build.
+static void IEL_identity(void* view) {
+  *(IntersectionEventList*)view = IntersectionEventList_make();
+}
 
-        IntersectionType intersectionType =
-            intersect(l1, l2, collisionWorld->timeStep);
-        if (intersectionType != NO_INTERSECTION) {
-          IntersectionEventList_appendNode(&iel, l1, l2, intersectionType);
-          collisionWorld->numLineLineCollisions++;
-        }
-        acc_nd = acc_nd->next;
+static void IEL_reduce(void* left, void* right) {
+  IntersectionEventList_concat(left, right);
+}
+
+static void count_identity(void* view) { *(unsigned int*)view = 0; }
+
+static void count_reduce(void* left, void* right) {
+  *(unsigned int*)left += *(unsigned int*)right;
+}
+
+// Counts of candidate pairs rejected by the swept box test and passed on to
+// the exact test.
+struct FilterStats {
+  uint64_t rejected;
+  uint64_t tested;
+};
+typedef struct FilterStats FilterStats;
+
+static void stats_identity(void* view) {
+  *(FilterStats*)view = (FilterStats){.rejected = 0, .tested = 0};
+}
+
+static void stats_reduce(void* left, void* right) {
+  ((FilterStats*)left)->rejected += ((FilterStats*)right)->rejected;
+  ((FilterStats*)left)->tested += ((FilterStats*)right)->tested;
+}
+
+typedef IntersectionEventList cilk_reducer(IEL_identity, IEL_reduce)
+    IntersectionEventListReducer;
+typedef unsigned int cilk_reducer(count_identity, count_reduce) CountReducer;
+typedef FilterStats cilk_reducer(stats_identity, stats_reduce)
+    FilterStatsReducer;
+
+// Broad phase traversal state shared by all strands.
+struct IEL_Context {
+  // The structure of the broad phase in use.
+  const QuadTree* qt;
+  const Grid* grid;
+  const SweepAndPrune* sap;
+  const LinearQuadTree* lqt;
+  double timeStep;
+  // One arena per worker for scratch arrays, since Arena_alloc is not thread
+  // safe.
+  Arena** workerArenas;
+  // Geometry of each line, indexed by line ID.
+  const LineGeom* geom;
+  IntersectionEventListReducer* iel;
+  CountReducer* numCollisions;
+  FilterStatsReducer* stats;
+};
+typedef struct IEL_Context IEL_Context;
+
+static inline Arena* IEL_arena(const IEL_Context* ctx) {
+  return ctx->workerArenas[__cilkrts_get_worker_number()];
+}
+
+static inline bool LineGeom_overlap(const LineGeom* a, const LineGeom* b) {
+  return a->xmin <= b->xmax && b->xmin <= a->xmax && a->ymin <= b->ymax &&
+         b->ymin <= a->ymax;
+}
+
+// Records the events found between line id and each of the n lines whose IDs
+// are in ids. Pairs with disjoint swept boxes are dropped before the exact
+// test; cands and results are scratch space for n entries.
+static inline void IEL_testBlock(const IEL_Context* ctx, uint32_t id,
+                                 const uint32_t* ids, uint32_t n, Line** cands,
+                                 IntersectionType* results) {
+  const LineGeom* g = &ctx->geom[id];
+  uint32_t num_cands = 0;
+  for (uint32_t j = 0; j < n; j++) {
+    const LineGeom* h = &ctx->geom[ids[j]];
+    if (LineGeom_overlap(g, h)) {
+      cands[num_cands++] = h->line;
+    }
+  }
+  // &*ctx->stats is this strand's view of the counters.
+  FilterStats* stats = &*ctx->stats;
+  stats->rejected += n - num_cands;
+  stats->tested += num_cands;
+
+  Line* l1 = g->line;
+  intersect_batch(l1, cands, num_cands, ctx->timeStep, results);
+  for (uint32_t j = 0; j < num_cands; j++) {
+    if (results[j] != NO_INTERSECTION) {
+      Line* l2 = cands[j];
+      // &*ctx->iel is this strand's view of the list.
+      if (compareLines(l1, l2) < 0) {
+        IntersectionEventList_appendNode(&*ctx->iel, l1, l2, results[j]);
+      } else {
+        IntersectionEventList_appendNode(&*ctx->iel, l2, l1, results[j]);
       }
-      cont_nd = cont_nd->next;
+      (*ctx->numCollisions)++;
     }
   }
+}
 
-  // Check all contained pgs against each other
-  if (qt->contained_sz > 0) {
-    LinePgListNode* cont_nd = qt->contained.head;
-    while (cont_nd != NULL) {
-      LinePgListNode* acc_nd = cont_nd->next;
-      while (acc_nd != NULL) {
-        Line* l1 = cont_nd->pg->now;
-        Line* l2 = acc_nd->pg->now;
-        if (compareLines(l1, l2) >= 0) {
-          Line* temp = l1;
-          l1 = l2;
-          l2 = temp;
-        }
+// Checks the lines stored in node against each other and against the
+// acc_sz lines stored in node's ancestors, then recurs into node's children
+// in parallel. The ancestors' IDs are gathered from the parent links into
+// scratch memory that is released before the children run, so scratch use
+// stays bounded by the largest node instead of growing with the tree.
+void IEL_QT_compute(const IEL_Context* ctx, uint32_t node, uint32_t acc_sz) {
+  const QuadTree* qt = ctx->qt;
+  const QuadTreeNode* n = QuadTree_node(qt, node);
+
+  if (n->count > 0) {
+    // Gather the ancestors' lines followed by the contained ones. Testing
+    // each contained line against everything before it checks it against the
+    // ancestors' lines and the contained lines before it in one contiguous
+    // block.
+    Arena* arena = IEL_arena(ctx);
+    const ArenaMark mark = Arena_mark(arena);
+    const uint32_t ids_sz = acc_sz + n->count;
+    uint32_t* ids = Arena_alloc(arena, ids_sz * sizeof(uint32_t));
+    Line** cands = Arena_alloc(arena, ids_sz * sizeof(Line*));
+    IntersectionType* results =
+        Arena_alloc(arena, ids_sz * sizeof(IntersectionType));
+    // The tree's items are the lines in ID order, so its slots are line IDs.
+    uint32_t end = acc_sz;
+    for (uint32_t a = node; a != QT_ROOT && end > 0;) {
+      a = QuadTree_node(qt, a)->parent;
+      const QuadTreeNode* ancestor = QuadTree_node(qt, a);
+      end -= ancestor->count;
+      memcpy(ids + end, qt->slots + ancestor->first,
+             ancestor->count * sizeof(uint32_t));
+    }
+    const uint32_t* slots = qt->slots + n->first;
+    for (uint32_t i = 0; i < n->count; i++) {
+      ids[acc_sz + i] = slots[i];
+      IEL_testBlock(ctx, slots[i], ids, acc_sz + i, cands, results);
+    }
+    Arena_rewind(arena, mark);
+    acc_sz = ids_sz;
+  }
+
+  if (!QuadTree_isleaf(qt, node)) {
+    // Recur into children
+    const uint32_t children = n->children;
+    cilk_spawn IEL_QT_compute(ctx, children, acc_sz);
+    cilk_spawn IEL_QT_compute(ctx, children + 1, acc_sz);
+    cilk_spawn IEL_QT_compute(ctx, children + 2, acc_sz);
+    IEL_QT_compute(ctx, children + 3, acc_sz);
+    cilk_sync;
+  }
+}
 
-        IntersectionType intersectionType =
-            intersect(l1, l2, collisionWorld->timeStep);
-        if (intersectionType != NO_INTERSECTION) {
-          IntersectionEventList_appendNode(&iel, l1, l2, intersectionType);
-          collisionWorld->numLineLineCollisions++;
+// Checks the pairs of lines listed in each cell of the grid, in parallel over
+// the cells. A pair is only tested in the cell Grid_owns picks for it.
+void IEL_Grid_compute(const IEL_Context* ctx) {
+  const Grid* grid = ctx->grid;
+  cilk_for (uint32_t c = 0; c < Grid_numCells(grid); c++) {
+    const uint32_t first = grid->cell_start[c];
+    const uint32_t count = grid->cell_start[c + 1] - first;
+    if (count < 2) {
+      continue;
+    }
+    const uint32_t cx = c % grid->cols;
+    const uint32_t cy = c / grid->cols;
+    const uint32_t* items = grid->items + first;
+
+    // The scratch arrays only live for this cell.
+    Arena* arena = IEL_arena(ctx);
+    const ArenaMark mark = Arena_mark(arena);
+    uint32_t* ids = Arena_alloc(arena, count * sizeof(uint32_t));
+    Line** cands = Arena_alloc(arena, count * sizeof(Line*));
+    IntersectionType* results =
+        Arena_alloc(arena, count * sizeof(IntersectionType));
+    for (uint32_t i = 1; i < count; i++) {
+      uint32_t num_ids = 0;
+      for (uint32_t j = 0; j < i; j++) {
+        if (Grid_owns(grid, cx, cy, items[i], items[j])) {
+          ids[num_ids++] = items[j];
         }
-        acc_nd = acc_nd->next;
       }
-      cont_nd = cont_nd->next;
+      IEL_testBlock(ctx, items[i], ids, num_ids, cands, results);
     }
+    Arena_rewind(arena, mark);
   }
+}
 
-  if (!QuadTree_isleaf(qt)) {
-    // add contained pgs to accumulator
-    if (qt->contained_sz > 0) {
-      LinePgListNode* nd = qt->contained.head;
-      while (nd != NULL) {
-        LinePg* newpg = malloc(sizeof(LinePg));
-        *newpg = *nd->pg;
-        LinePgList_append(pgl, newpg);
-        nd = nd->next;
+// Checks each line against the lines whose swept x interval starts inside its
+// own, in parallel over the sorted endpoints. Every overlapping pair is found
+// exactly once, from the line whose interval starts first.
+void IEL_SAP_compute(const IEL_Context* ctx) {
+  const SweepAndPrune* sap = ctx->sap;
+  const SweepEndpoint* endpoints = sap->endpoints;
+  cilk_for (uint32_t p = 0; p < 2 * sap->num_lines; p++) {
+    if (SweepEndpoint_isMax(endpoints[p])) {
+      continue;
+    }
+    const uint32_t id = SweepEndpoint_id(endpoints[p]);
+    uint32_t count = 0;
+    uint32_t end = p + 1;
+    for (; SweepEndpoint_id(endpoints[end]) != id; end++) {
+      count += !SweepEndpoint_isMax(endpoints[end]);
+    }
+    if (count == 0) {
+      continue;
+    }
+
+    // The scratch arrays only live for this line.
+    Arena* arena = IEL_arena(ctx);
+    const ArenaMark mark = Arena_mark(arena);
+    uint32_t* ids = Arena_alloc(arena, count * sizeof(uint32_t));
+    Line** cands = Arena_alloc(arena, count * sizeof(Line*));
+    IntersectionType* results =
+        Arena_alloc(arena, count * sizeof(IntersectionType));
+    uint32_t num_ids = 0;
+    for (uint32_t q = p + 1; q < end; q++) {
+      if (!SweepEndpoint_isMax(endpoints[q])) {
+        ids[num_ids++] = SweepEndpoint_id(endpoints[q]);
       }
     }
+    IEL_testBlock(ctx, id, ids, num_ids, cands, results);
+    Arena_rewind(arena, mark);
+  }
+}
 
-    // Recur into children
-    IEL_QT_compute(iel, qt->nw, pgl, collisionWorld);
-    IEL_QT_compute(iel, qt->ne, pgl, collisionWorld);
-    IEL_QT_compute(iel, qt->sw, pgl, collisionWorld);
-    IEL_QT_compute(iel, qt->se, pgl, collisionWorld);
+// Checks each line against the lines after it in the sorted linear quadtree
+// that lie in its own cell or in cells inside it, in parallel over the lines.
+// Every pair whose cells nest is found exactly once, from the line in the
+// larger cell or from the earlier line of a shared cell.
+void IEL_LQT_compute(const IEL_Context* ctx) {
+  const LinearQuadTree* lqt = ctx->lqt;
+  cilk_for (uint32_t i = 0; i < lqt->num_lines; i++) {
+    const uint32_t max_ids = LinearQuadTree_subtreeEnd(lqt, i) - i - 1;
+    if (max_ids == 0) {
+      continue;
+    }
 
-    LinePgList_droplast(pgl, qt->contained_sz);
+    // The scratch arrays only live for this line, so sizing ids for the whole
+    // subtree costs no more than the largest subtree per worker.
+    Arena* arena = IEL_arena(ctx);
+    const ArenaMark mark = Arena_mark(arena);
+    uint32_t* ids = Arena_alloc(arena, max_ids * sizeof(uint32_t));
+    const uint32_t num_ids = LinearQuadTree_candidates(lqt, i, ctx->geom, ids);
+    Line** cands = Arena_alloc(arena, num_ids * sizeof(Line*));
+    IntersectionType* results =
+        Arena_alloc(arena, num_ids * sizeof(IntersectionType));
+    IEL_testBlock(ctx, lqt->ids[i], ids, num_ids, cands, results);
+    Arena_rewind(arena, mark);
   }
 }
 
-void CollisionWorld_detectIntersection2(CollisionWorld* collisionWorld) {
-  IntersectionEventList intersectionEventList = IntersectionEventList_make();
+// Returns line as it will be after the next time step.
+static inline Line CollisionWorld_nextLine(const CollisionWorld* collisionWorld,
+                                           const Line* line) {
+  Line next = *line;
+  next.p1 =
+      Vec_add(next.p1, Vec_multiply(next.velocity, collisionWorld->timeStep));
+  next.p2 =
+      Vec_add(next.p2, Vec_multiply(next.velocity, collisionWorld->timeStep));
+  return next;
+}
 
-  // make the quadtree
-  AABB boundary = {
-      .center =
-          Vec_make((BOX_XMIN + BOX_XMAX) / 2.0, (BOX_YMIN + BOX_YMAX) / 2.0),
-      .half_dim =
-          Vec_make((BOX_XMAX - BOX_XMIN) / 2.0, (BOX_YMAX - BOX_YMIN) / 2.0),
+// Computes the frame's geometry of line, whose next position is next.
+static inline LineGeom LineGeom_make(Line* line, const Line* next) {
+  const double slop = LINE_GEOM_SLOP;
+  const Vec dir = Vec_makeFromLine(line);
+  return (LineGeom){
+      .line = line,
+      .xmin = fmin(fmin(line->p1.x, line->p2.x), fmin(next->p1.x, next->p2.x)) -
+              slop,
+      .ymin = fmin(fmin(line->p1.y, line->p2.y), fmin(next->p1.y, next->p2.y)) -
+              slop,
+      .xmax = fmax(fmax(line->p1.x, line->p2.x), fmax(next->p1.x, next->p2.x)) +
+              slop,
+      .ymax = fmax(fmax(line->p1.y, line->p2.y), fmax(next->p1.y, next->p2.y)) +
+              slop,
+      .dir = dir,
+      .length = Vec_length(dir),
   };
-  QuadTree* qt = QuadTree_init(boundary);
-  for (int i = 0; i < collisionWorld->numOfLines; i++) {
-    Line* l = collisionWorld->lines[i];
-    Line next = *l;
-    next.p1 =
-        Vec_add(next.p1, Vec_multiply(next.velocity, collisionWorld->timeStep));
-    next.p2 =
-        Vec_add(next.p2, Vec_multiply(next.velocity, collisionWorld->timeStep));
-    // TODO: maybe remove this malloc and not use pointers for linepgs
-    LinePg* pg = malloc(sizeof(LinePg));
-    *pg = (LinePg){
-        .next = next,
-        .now = l,
+}
+
+// Brings the structure of the selected broad phase up to date with the
+// frame's geometry and points ctx at it.
+static void CollisionWorld_buildBroadPhase(CollisionWorld* collisionWorld,
+                                           const LineGeom* geom,
+                                           IEL_Context* ctx) {
+  const unsigned int n = collisionWorld->numOfLines;
+  if (collisionWorld->broadPhase == BROAD_PHASE_GRID) {
+    // The grid is rebuilt from scratch every frame.
+    Grid_build(collisionWorld->grid, BOX_XMIN, BOX_YMIN, BOX_XMAX, BOX_YMAX,
+               geom, n);
+    ctx->grid = collisionWorld->grid;
+  } else if (collisionWorld->broadPhase == BROAD_PHASE_SWEEP) {
+    // The endpoints stay sorted across frames.
+    SweepAndPrune_update(collisionWorld->sap, geom, n);
+    ctx->sap = collisionWorld->sap;
+  } else if (collisionWorld->broadPhase == BROAD_PHASE_MORTON) {
+    // The linear quadtree is re-sorted from scratch every frame.
+    LinearQuadTree_build(collisionWorld->lqt, BOX_XMIN, BOX_YMIN, BOX_XMAX,
+                         BOX_YMAX, geom, n);
+    ctx->lqt = collisionWorld->lqt;
+  } else {
+    // make the quadtree
+    AABB boundary = {
+        .center =
+            Vec_make((BOX_XMIN + BOX_XMAX) / 2.0, (BOX_YMIN + BOX_YMAX) / 2.0),
+        .half_dim =
+            Vec_make((BOX_XMAX - BOX_XMIN) / 2.0, (BOX_YMAX - BOX_YMIN) / 2.0),
     };
-    QuadTree_insert(qt, pg);
+    LinePg* pgs = Arena_alloc(collisionWorld->frameArena, n * sizeof(LinePg));
+    cilk_for (int i = 0; i < n; i++) {
+      Line* l = collisionWorld->lines[i];
+      pgs[i] = (LinePg){
+          .next = CollisionWorld_nextLine(collisionWorld, l),
+          .now = l,
+          .node = QT_ROOT,
+      };
+    }
+    // The quadtree persists across frames and only relocates the lines whose
+    // parallelogram left their node, or now fits one of its children, since
+    // the last frame.
+    QuadTree_update(collisionWorld->quadTree, boundary, pgs, n);
+    ctx->qt = collisionWorld->quadTree;
+  }
+}
+
+// Finds and tests the candidate pairs of the broad phase ctx points at.
+static void IEL_compute(const IEL_Context* ctx) {
+  if (ctx->grid != NULL) {
+    IEL_Grid_compute(ctx);
+  } else if (ctx->sap != NULL) {
+    IEL_SAP_compute(ctx);
+  } else if (ctx->lqt != NULL) {
+    IEL_LQT_compute(ctx);
+  } else {
+    // Iterate through the quadtree accumulating pgs down to the leaves and at
+    // each node check its pgs against each other and the accumulated ones.
+    IEL_QT_compute(ctx, QT_ROOT, 0);
+  }
+}
+
+// Runs the collision solver on the sorted events, with the same result as
+// solving them one after the other. An event must see the velocities left by
+// every earlier event on its lines, so events are colored greedily in sort
+// order: each goes into the batch after the last one that touched either of
+// its lines. Events within a batch share no lines and are solved in parallel,
+// and batches run in order, so every line sees its events in sort order.
+static void CollisionWorld_solveEvents(CollisionWorld* collisionWorld,
+                                       const IntersectionEventList* iel,
+                                       Arena* arena) {
+  const IntersectionEvent* events = iel->events;
+  const uint32_t num_events = iel->size;
+  if (num_events < SOLVE_PARALLEL_THRESHOLD) {
+    for (uint32_t i = 0; i < num_events; i++) {
+      CollisionWorld_collisionSolver(collisionWorld, events[i].l1,
+                                     events[i].l2, events[i].intersectionType);
+    }
+    return;
+  }
+
+  // One past the batch of the latest event on each line, 0 if there is none.
+  const unsigned int n = collisionWorld->numOfLines;
+  uint32_t* line_batch = Arena_alloc(arena, n * sizeof(uint32_t));
+  memset(line_batch, 0, n * sizeof(uint32_t));
+  uint32_t* batch = Arena_alloc(arena, num_events * sizeof(uint32_t));
+  uint32_t num_batches = 0;
+  for (uint32_t i = 0; i < num_events; i++) {
+    const uint32_t id1 = events[i].l1->id;
+    const uint32_t id2 = events[i].l2->id;
+    const uint32_t b =
+        line_batch[id1] > line_batch[id2] ? line_batch[id1] : line_batch[id2];
+    batch[i] = b;
+    line_batch[id1] = b + 1;
+    line_batch[id2] = b + 1;
+    if (b + 1 > num_batches) {
+      num_batches = b + 1;
+    }
+  }
+
+  // Counting sort of the events by batch. Afterwards batch b is
+  // order[end[b - 1]] up to order[end[b]].
+  uint32_t* end = Arena_alloc(arena, (num_batches + 1) * sizeof(uint32_t));
+  memset(end, 0, (num_batches + 1) * sizeof(uint32_t));
+  for (uint32_t i = 0; i < num_events; i++) {
+    end[batch[i] + 1]++;
+  }
+  for (uint32_t b = 1; b <= num_batches; b++) {
+    end[b] += end[b - 1];
+  }
+  uint32_t* order = Arena_alloc(arena, num_events * sizeof(uint32_t));
+  for (uint32_t i = 0; i < num_events; i++) {
+    order[end[batch[i]]++] = i;
+  }
+
+  uint32_t begin = 0;
+  for (uint32_t b = 0; b < num_batches; b++) {
+    if (end[b] - begin < SOLVE_MIN_BATCH) {
+      for (uint32_t k = begin; k < end[b]; k++) {
+        const IntersectionEvent* event = &events[order[k]];
+        CollisionWorld_collisionSolver(collisionWorld, event->l1, event->l2,
+                                       event->intersectionType);
+      }
+    } else {
+      cilk_for (uint32_t k = begin; k < end[b]; k++) {
+        const IntersectionEvent* event = &events[order[k]];
+        CollisionWorld_collisionSolver(collisionWorld, event->l1, event->l2,
+                                       event->intersectionType);
+      }
+    }
+    begin = end[b];
   }
+}
 
-  // Iterate through the quadtree and at each node, if that node has contained
-  // pgs, check those pgs against each other and all the ones in child nodes.
-  // Actually, iterate through the quadtree accumulating pgs down to the leaves
-  // and only check the accumulated ones.
-  // TODO:
-  LinePgList* pgl = malloc(sizeof(LinePgList));
-  pgl->head = NULL;
-  pgl->tail = NULL;
-  IEL_QT_compute(intersectionEventList, qt, pgl, collisionWorld);
-  LinePgList_free(pgl);
+void CollisionWorld_detectIntersection2(CollisionWorld* collisionWorld) {
+  const fasttime_t build_start = gettime();
+  INSTRUMENT_ONLY(const uint64_t build_cycles = Instrument_cycles();)
+  // Everything allocated below lives until the next frame.
+  Arena* arena = collisionWorld->frameArena;
+  Arena_reset(arena);
+  for (unsigned int i = 0; i < collisionWorld->numWorkers; i++) {
+    Arena_reset(collisionWorld->workerArenas[i]);
+  }
+  IntersectionEventListReducer intersectionEventList =
+      IntersectionEventList_make();
+  CountReducer numCollisions = 0;
+  FilterStatsReducer stats = {.rejected = 0, .tested = 0};
+
+  const unsigned int n = collisionWorld->numOfLines;
+  LineGeom* geom = Arena_alloc(arena, n * sizeof(LineGeom));
+  for (int i = 0; i < n; i++) {
+    Line* l = collisionWorld->lines[i];
+    const Line next = CollisionWorld_nextLine(collisionWorld, l);
+    geom[i] = LineGeom_make(l, &next);
+  }
+  collisionWorld->geom = geom;
+
+  IEL_Context ctx = {
+      .qt = NULL,
+      .grid = NULL,
+      .sap = NULL,
+      .lqt = NULL,
+      .timeStep = collisionWorld->timeStep,
+      .workerArenas = collisionWorld->workerArenas,
+      .geom = geom,
+      .iel = &intersectionEventList,
+      .numCollisions = &numCollisions,
+      .stats = &stats,
+  };
+  CollisionWorld_buildBroadPhase(collisionWorld, geom, &ctx);
 
-  QuadTree_free(qt);
+  const fasttime_t traverse_start = gettime();
+  INSTRUMENT_ONLY(const uint64_t traverse_cycles = Instrument_cycles();)
+  IEL_compute(&ctx);
+  collisionWorld->numLineLineCollisions += numCollisions;
+  collisionWorld->numPairsRejected += stats.rejected;
+  collisionWorld->numPairsTested += stats.tested;
 
   // Test all line-line pairs to see if they will intersect before the
   // next time step.
@@ -270,32 +742,36 @@ void CollisionWorld_detectIntersection2(CollisionWorld* collisionWorld) {
   // }
 
   // Sort the intersection event list.
-  IntersectionEventNode* startNode = intersectionEventList.head;
-  while (startNode != NULL) {
-    IntersectionEventNode* minNode = startNode;
-    IntersectionEventNode* curNode = startNode->next;
-    while (curNode != NULL) {
-      if (IntersectionEventNode_compareData(curNode, minNode) < 0) {
-        minNode = curNode;
-      }
-      curNode = curNode->next;
-    }
-    if (minNode != startNode) {
-      IntersectionEventNode_swapData(minNode, startNode);
-    }
-    startNode = startNode->next;
-  }
+  const fasttime_t sort_start = gettime();
+  INSTRUMENT_ONLY(const uint64_t sort_cycles = Instrument_cycles();)
+  IntersectionEventList_sort(&intersectionEventList);
 
   // Call the collision solver for each intersection event.
-  IntersectionEventNode* curNode = intersectionEventList.head;
-
-  while (curNode != NULL) {
-    CollisionWorld_collisionSolver(collisionWorld, curNode->l1, curNode->l2,
-                                   curNode->intersectionType);
-    curNode = curNode->next;
-  }
+  const fasttime_t solve_start = gettime();
+  INSTRUMENT_ONLY(const uint64_t solve_cycles = Instrument_cycles();)
+  CollisionWorld_solveEvents(collisionWorld, &intersectionEventList, arena);
 
   IntersectionEventList_deleteNodes(&intersectionEventList);
+  collisionWorld->geom = NULL;
+  INSTRUMENT_ONLY(const uint64_t end_cycles = Instrument_cycles();)
+  const fasttime_t solve_end = gettime();
+
+  PhaseTimes* phaseTimes = &collisionWorld->phaseTimes;
+  phaseTimes->build = tdiff(build_start, traverse_start);
+  phaseTimes->traverse = tdiff(traverse_start, sort_start);
+  phaseTimes->sort = tdiff(sort_start, solve_start);
+  phaseTimes->solve = tdiff(solve_start, solve_end);
+
+#ifdef INSTRUMENT
+  Instrument_phase(INSTRUMENT_BUILD, traverse_cycles - build_cycles);
+  Instrument_phase(INSTRUMENT_TRAVERSE, sort_cycles - traverse_cycles);
+  Instrument_phase(INSTRUMENT_SORT, solve_cycles - sort_cycles);
+  Instrument_phase(INSTRUMENT_SOLVE, end_cycles - solve_cycles);
+  if (ctx.qt != NULL) {
+    QuadTree_instrument(ctx.qt);
+  }
+  Instrument_frame(stats.rejected + stats.tested, stats.tested, numCollisions);
+#endif
 }
 
 void CollisionWorld_detectIntersection(CollisionWorld* collisionWorld) {
@@ -328,29 +804,13 @@ void CollisionWorld_detectIntersection(CollisionWorld* collisionWorld) {
   }
 
   // Sort the intersection event list.
-  IntersectionEventNode* startNode = intersectionEventList.head;
-  while (startNode != NULL) {
-    IntersectionEventNode* minNode = startNode;
-    IntersectionEventNode* curNode = startNode->next;
-    while (curNode != NULL) {
-      if (IntersectionEventNode_compareData(curNode, minNode) < 0) {
-        minNode = curNode;
-      }
-      curNode = curNode->next;
-    }
-    if (minNode != startNode) {
-      IntersectionEventNode_swapData(minNode, startNode);
-    }
-    startNode = startNode->next;
-  }
+  IntersectionEventList_sort(&intersectionEventList);
 
   // Call the collision solver for each intersection event.
-  IntersectionEventNode* curNode = intersectionEventList.head;
-
-  while (curNode != NULL) {
-    CollisionWorld_collisionSolver(collisionWorld, curNode->l1, curNode->l2,
-                                   curNode->intersectionType);
-    curNode = curNode->next;
+  for (size_t i = 0; i < intersectionEventList.size; i++) {
+    const IntersectionEvent* event = &intersectionEventList.events[i];
+    CollisionWorld_collisionSolver(collisionWorld, event->l1, event->l2,
+                                   event->intersectionType);
   }
 
   IntersectionEventList_deleteNodes(&intersectionEventList);
@@ -366,6 +826,28 @@ unsigned int CollisionWorld_getNumLineLineCollisions(
   return collisionWorld->numLineLineCollisions;
 }
 
+uint64_t CollisionWorld_getNumPairsRejected(CollisionWorld* collisionWorld) {
+  return collisionWorld->numPairsRejected;
+}
+
+uint64_t CollisionWorld_getNumPairsTested(CollisionWorld* collisionWorld) {
+  return collisionWorld->numPairsTested;
+}
+
+PhaseTimes CollisionWorld_getPhaseTimes(CollisionWorld* collisionWorld) {
+  return collisionWorld->phaseTimes;
+}
+
+// Snaps the velocity the collision solver gave line and, in SoA mode, stores it
+// in the arrays as well.
+static inline void CollisionWorld_settleVelocity(CollisionWorld* collisionWorld,
+                                                 Line* line) {
+  Line_snapVelocity(line, collisionWorld->timeStep);
+  if (collisionWorld->soa != NULL) {
+    LineSoA_storeVelocity(collisionWorld->soa, line->id, line->velocity);
+  }
+}
+
 void CollisionWorld_collisionSolver(CollisionWorld* collisionWorld, Line* l1,
                                     Line* l2,
                                     IntersectionType intersectionType) {
@@ -398,17 +880,23 @@ void CollisionWorld_collisionSolver(CollisionWorld* collisionWorld, Line* l1,
       l2->velocity = Vec_multiply(Vec_normalize(Vec_subtract(l2->p1, p)),
                                   Vec_length(l2->velocity));
     }
+    CollisionWorld_settleVelocity(collisionWorld, l1);
+    CollisionWorld_settleVelocity(collisionWorld, l2);
     return;
   }
 
   // Compute the collision face/normal vectors.
   Vec face;
   Vec normal;
+  // Line directions and lengths come from the frame's cached geometry when
+  // there is one. Lines only translate, so they match the lines' current
+  // state.
+  const LineGeom* geom = collisionWorld->geom;
   if (intersectionType == L1_WITH_L2) {
-    Vec v = Vec_makeFromLine(*l2);
+    Vec v = geom != NULL ? geom[l2->id].dir : Vec_makeFromLine(l2);
     face = Vec_normalize(v);
   } else {
-    Vec v = Vec_makeFromLine(*l1);
+    Vec v = geom != NULL ? geom[l1->id].dir : Vec_makeFromLine(l1);
     face = Vec_normalize(v);
   }
   normal = Vec_orthogonal(face);
@@ -421,8 +909,10 @@ void CollisionWorld_collisionSolver(CollisionWorld* collisionWorld, Line* l1,
   double v2Normal = Vec_dotProduct(l2->velocity, normal);
 
   // Compute the mass of each line (we simply use its length).
-  double m1 = Vec_length(Vec_subtract(l1->p1, l1->p2));
-  double m2 = Vec_length(Vec_subtract(l2->p1, l2->p2));
+  double m1 = geom != NULL ? geom[l1->id].length
+                           : Vec_length(Vec_subtract(l1->p1, l1->p2));
+  double m2 = geom != NULL ? geom[l2->id].length
+                           : Vec_length(Vec_subtract(l2->p1, l2->p2));
 
   // Perform the collision calculation (computes the new velocities along
   // the direction normal to the collision face such that momentum and
@@ -437,6 +927,8 @@ void CollisionWorld_collisionSolver(CollisionWorld* collisionWorld, Line* l1,
       Vec_add(Vec_multiply(normal, newV1Normal), Vec_multiply(face, v1Face));
   l2->velocity =
       Vec_add(Vec_multiply(normal, newV2Normal), Vec_multiply(face, v2Face));
+  CollisionWorld_settleVelocity(collisionWorld, l1);
+  CollisionWorld_settleVelocity(collisionWorld, l2);
 
   return;
 }
@@ -24,9 +24,52 @@
 #ifndef COLLISIONWORLD_H_
 #define COLLISIONWORLD_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
+#include "./arena.h"
+#include "./grid.h"
 #include "./line.h"
+#include "./line_soa.h"
+#include "./linear_quadtree.h"
+#include "./quadtree.h"
+#include "./sweep_and_prune.h"
 #include "./intersection_detection.h"
 
+// Broad phase that CollisionWorld_detectIntersection2 uses to find candidate
+// pairs of lines.
+typedef enum {
+  // Persistent quadtree, updated incrementally (the default).
+  BROAD_PHASE_QUADTREE,
+  // Uniform grid rebuilt every frame, for dense scenes of similar lines.
+  BROAD_PHASE_GRID,
+  // Sweep and prune on x with endpoints kept sorted across frames, for
+  // scenes whose lines move coherently.
+  BROAD_PHASE_SWEEP,
+  // Linear quadtree of lines sorted by Morton code, rebuilt every frame.
+  BROAD_PHASE_MORTON
+} BroadPhase;
+
+// Wall-clock seconds spent in each phase of the latest frame.
+struct PhaseTimes {
+  // In SoA mode, copying the arrays into the Line structs that the intersection
+  // code reads. 0 otherwise.
+  double load;
+  // Per-frame line geometry and the broad phase structure.
+  double build;
+  // Finding candidate pairs and testing them.
+  double traverse;
+  // Sorting the intersection events.
+  double sort;
+  // Running the collision solver on the events.
+  double solve;
+  // Moving the lines.
+  double position;
+  // Line-wall collisions.
+  double wall;
+};
+typedef struct PhaseTimes PhaseTimes;
+
 struct CollisionWorld {
   // Time step used for simulation
   double timeStep;
@@ -35,12 +78,59 @@ struct CollisionWorld {
   // This CollisionWorld owns the Line* lines.
   Line** lines;
   unsigned int numOfLines;
+  unsigned int capacity;
+
+  // If not NULL, the lines are the elements of this one array rather than
+  // separate allocations. The array is from malloc, or lies inside
+  // lineMapping, a file mapping of lineMappingSize bytes, if that is not
+  // NULL.
+  Line* lineBlock;
+  void* lineMapping;
+  size_t lineMappingSize;
 
   // Record the total number of line-wall collisions.
   unsigned int numLineWallCollisions;
 
   // Record the total number of line-line intersections.
   unsigned int numLineLineCollisions;
+
+  // Candidate pairs from the broad phase that were rejected because their
+  // swept boxes are disjoint, and those that went on to the exact test.
+  uint64_t numPairsRejected;
+  uint64_t numPairsTested;
+
+  // Timings of the latest call to CollisionWorld_updateLines.
+  PhaseTimes phaseTimes;
+
+  // Geometry of each line for the current frame, indexed by line ID, or NULL
+  // outside of CollisionWorld_detectIntersection2.
+  LineGeom* geom;
+
+  // If not NULL, the lines' endpoints and velocities live here. The Line
+  // structs get a copy of them for the intersection code every frame, and the
+  // collision solver writes the velocities it changes to both. See
+  // CollisionWorld_enableSoA.
+  LineSoA* soa;
+
+  // Scratch memory for one call to CollisionWorld_detectIntersection2, reset
+  // at the start of every frame.
+  Arena* frameArena;
+
+  // Per-worker scratch arenas for the parallel part of a frame, also reset
+  // every frame.
+  Arena** workerArenas;
+  unsigned int numWorkers;
+
+  // Broad phase in use, and the acceleration structure of each.
+  BroadPhase broadPhase;
+  // Updated incrementally every frame.
+  QuadTree* quadTree;
+  // Rebuilt every frame.
+  Grid* grid;
+  // Re-sorted every frame.
+  SweepAndPrune* sap;
+  // Rebuilt every frame.
+  LinearQuadTree* lqt;
 };
 typedef struct CollisionWorld CollisionWorld;
 
@@ -53,9 +143,38 @@ unsigned int CollisionWorld_getNumOfLines(CollisionWorld* collisionWorld);
 
 // Add a line into the box.  Must be under capacity.
 // This CollisionWorld becomes owner of the Line* line.
+// Line IDs must be the lines' indices, i.e. the nth line added has ID n.
 void CollisionWorld_addLine(CollisionWorld* collisionWorld, Line *line);
 
-// Get a line from box.
+// Adds the n lines in block, which must be the first lines added and have IDs
+// 0 to n - 1 in order. This CollisionWorld becomes owner of block, which must
+// come from malloc.
+void CollisionWorld_addLineBlock(CollisionWorld* collisionWorld, Line* block,
+                                 const unsigned int n);
+
+// Like CollisionWorld_addLineBlock, but block lies inside the mapping of
+// mappingSize bytes at mapping, which is unmapped when this CollisionWorld is
+// deleted.
+void CollisionWorld_addMappedLineBlock(CollisionWorld* collisionWorld,
+                                       Line* block, const unsigned int n,
+                                       void* mapping, size_t mappingSize);
+
+// Switches to keeping the lines' endpoints and velocities in structure-of-
+// arrays form, so that position and wall updates run as SIMD kernels. Must be
+// called after all lines have been added.
+void CollisionWorld_enableSoA(CollisionWorld* collisionWorld);
+
+// Selects the broad phase used to find candidate pairs.
+void CollisionWorld_setBroadPhase(CollisionWorld* collisionWorld,
+                                  BroadPhase broadPhase);
+
+// Sets the shape of the quadtree broad phase. The tree is rebuilt on the next
+// frame.
+void CollisionWorld_setQuadTreeParams(CollisionWorld* collisionWorld,
+                                      QuadTreeParams params);
+
+// Get a line from box. In SoA mode the returned Line is refreshed from the
+// arrays on every call.
 Line* CollisionWorld_getLine(CollisionWorld* collisionWorld,
                              const unsigned int index);
 
@@ -80,6 +199,15 @@ unsigned int CollisionWorld_getNumLineWallCollisions(
 unsigned int CollisionWorld_getNumLineLineCollisions(
     CollisionWorld* collisionWorld);
 
+// Get the number of candidate pairs rejected by the swept box test.
+uint64_t CollisionWorld_getNumPairsRejected(CollisionWorld* collisionWorld);
+
+// Get the number of candidate pairs that went through the exact test.
+uint64_t CollisionWorld_getNumPairsTested(CollisionWorld* collisionWorld);
+
+// Get the time spent in each phase of the latest frame.
+PhaseTimes CollisionWorld_getPhaseTimes(CollisionWorld* collisionWorld);
+
 // Update the two lines based on their intersection event.
 // Precondition: compareLines(l1, l2) < 0 must be true.
 void CollisionWorld_collisionSolver(CollisionWorld* collisionWorld, Line *l1,
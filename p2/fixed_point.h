@@ -0,0 +1,75 @@
+#ifndef FIXED_POINT_H_
+#define FIXED_POINT_H_
+
+// Fixed-point coordinate mode (make FIXED_POINT=1). Line endpoints and
+// velocities keep their double storage, but every value is held on a lattice
+// of 1 / FIXED_ONE box units: endpoints are snapped when lines are added, and
+// velocities are snapped so that one time step moves a line by a whole number
+// of lattice steps. Converting a coordinate to an integer is then exact, and
+// the orientation tests in intersection_detection.c run on integers.
+//
+// Box coordinates stay below 2, so coordinates fit in 25 bits, their
+// differences in 26 and the cross products of differences in 53. Orientations
+// are therefore exact both in int64 and in double, and the scalar integer
+// tests and the AVX2 double tests agree bit for bit whatever the compiler
+// does with contraction or reassociation.
+
+#include <math.h>
+#include <stdint.h>
+
+#include "./line.h"
+
+#define FIXED_FRACTION_BITS 24
+#define FIXED_ONE (1 << FIXED_FRACTION_BITS)
+
+typedef int32_t fixed_dimension;
+
+// A point on the lattice, in units of 1 / FIXED_ONE.
+struct FixedVec {
+  fixed_dimension x;
+  fixed_dimension y;
+};
+typedef struct FixedVec FixedVec;
+
+// Converts a point on the lattice. The product is an integer, so the cast is
+// exact.
+static inline FixedVec FixedVec_make(Vec v) {
+  return (FixedVec){.x = (fixed_dimension)(v.x * FIXED_ONE),
+                    .y = (fixed_dimension)(v.y * FIXED_ONE)};
+}
+
+// Rounds a box coordinate to the nearest lattice point.
+static inline double Fixed_snap(double x) {
+  return rint(x * FIXED_ONE) / FIXED_ONE;
+}
+
+// Rounds a velocity so that it moves a line by a whole number of lattice
+// steps in timeStep. Exact for the power-of-two time steps CollisionWorld
+// uses.
+static inline double Fixed_snapVelocity(double v, double timeStep) {
+  return Fixed_snap(v * timeStep) / timeStep;
+}
+
+#ifdef FIXED_POINT
+
+// Moves line's velocity onto the lattice.
+static inline void Line_snapVelocity(Line* line, double timeStep) {
+  line->velocity.x = Fixed_snapVelocity(line->velocity.x, timeStep);
+  line->velocity.y = Fixed_snapVelocity(line->velocity.y, timeStep);
+}
+
+// Moves line's endpoints and velocity onto the lattice.
+static inline void Line_snap(Line* line, double timeStep) {
+  line->p1 = Vec_make(Fixed_snap(line->p1.x), Fixed_snap(line->p1.y));
+  line->p2 = Vec_make(Fixed_snap(line->p2.x), Fixed_snap(line->p2.y));
+  Line_snapVelocity(line, timeStep);
+}
+
+#else
+
+static inline void Line_snapVelocity(Line* line, double timeStep) {}
+static inline void Line_snap(Line* line, double timeStep) {}
+
+#endif  // FIXED_POINT
+
+#endif  // FIXED_POINT_H_
@@ -0,0 +1,138 @@
+#include "grid.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+
+Grid* Grid_new() {
+  Grid* grid = malloc(sizeof(Grid));
+  *grid = (Grid){
+      .xmin = 0,
+      .ymin = 0,
+      .inv_cell_size = 0,
+      .cols = 0,
+      .rows = 0,
+      .cell_start = NULL,
+      .cells_capacity = 0,
+      .items = NULL,
+      .items_capacity = 0,
+      .ranges = NULL,
+      .ranges_capacity = 0,
+  };
+  return grid;
+}
+
+void Grid_delete(Grid* grid) {
+  if (grid == NULL) return;
+  free(grid->cell_start);
+  free(grid->items);
+  free(grid->ranges);
+  free(grid);
+}
+
+// Returns the column or row of coordinate v, clamped to [0, max].
+static inline uint32_t Grid_coord(double v, double origin, double inv_cell_size,
+                                  uint32_t max) {
+  const double c = floor((v - origin) * inv_cell_size);
+  if (!(c > 0)) return 0;
+  if (c >= max) return max;
+  return (uint32_t)c;
+}
+
+// Picks the cell size and grid dimensions for the given swept boxes.
+static void Grid_layout(Grid* const grid, double xmin, double ymin,
+                        double xmax, double ymax, const LineGeom* geom,
+                        uint32_t num_lines) {
+  const double width = xmax - xmin;
+  const double height = ymax - ymin;
+
+  double extent = 0;
+  for (uint32_t i = 0; i < num_lines; i++) {
+    const double w = geom[i].xmax - geom[i].xmin;
+    const double h = geom[i].ymax - geom[i].ymin;
+    extent += w > h ? w : h;
+  }
+  double cell_size = GRID_CELL_SCALE * extent / num_lines;
+
+  // Cap the cell count, which also handles lines with no extent at all.
+  const double max_cells = (double)GRID_MAX_CELLS_PER_LINE * num_lines;
+  if (!(cell_size * cell_size * max_cells >= width * height)) {
+    cell_size = sqrt(width * height / max_cells);
+  }
+
+  grid->xmin = xmin;
+  grid->ymin = ymin;
+  grid->inv_cell_size = 1.0 / cell_size;
+  grid->cols = (uint32_t)ceil(width / cell_size);
+  grid->rows = (uint32_t)ceil(height / cell_size);
+  if (grid->cols == 0) grid->cols = 1;
+  if (grid->rows == 0) grid->rows = 1;
+}
+
+void Grid_build(Grid* grid, double xmin, double ymin, double xmax, double ymax,
+                const LineGeom* geom, uint32_t num_lines) {
+  if (num_lines == 0) {
+    grid->cols = 0;
+    grid->rows = 0;
+    return;
+  }
+  Grid_layout(grid, xmin, ymin, xmax, ymax, geom, num_lines);
+
+  const uint32_t num_cells = Grid_numCells(grid);
+  if (num_cells + 1 > grid->cells_capacity) {
+    grid->cells_capacity = num_cells + 1;
+    free(grid->cell_start);
+    grid->cell_start = malloc(grid->cells_capacity * sizeof(uint32_t));
+  }
+  if (num_lines > grid->ranges_capacity) {
+    grid->ranges_capacity = num_lines;
+    free(grid->ranges);
+    grid->ranges = malloc(grid->ranges_capacity * sizeof(GridRange));
+  }
+  assert(grid->cell_start != NULL && grid->ranges != NULL);
+
+  // Count the lines in each cell, shifted by one so that the prefix sum
+  // leaves cell_start[c + 1] pointing at the start of cell c.
+  uint32_t* const cell_start = grid->cell_start;
+  for (uint32_t c = 0; c <= num_cells; c++) {
+    cell_start[c] = 0;
+  }
+  for (uint32_t i = 0; i < num_lines; i++) {
+    GridRange* r = &grid->ranges[i];
+    r->x0 = Grid_coord(geom[i].xmin, xmin, grid->inv_cell_size, grid->cols - 1);
+    r->x1 = Grid_coord(geom[i].xmax, xmin, grid->inv_cell_size, grid->cols - 1);
+    r->y0 = Grid_coord(geom[i].ymin, ymin, grid->inv_cell_size, grid->rows - 1);
+    r->y1 = Grid_coord(geom[i].ymax, ymin, grid->inv_cell_size, grid->rows - 1);
+    for (uint32_t cy = r->y0; cy <= r->y1; cy++) {
+      for (uint32_t cx = r->x0; cx <= r->x1; cx++) {
+        cell_start[cy * grid->cols + cx + 1]++;
+      }
+    }
+  }
+  for (uint32_t c = 0; c < num_cells; c++) {
+    cell_start[c + 1] += cell_start[c];
+  }
+
+  const uint32_t num_items = cell_start[num_cells];
+  if (num_items > grid->items_capacity) {
+    grid->items_capacity = 2 * num_items;
+    free(grid->items);
+    grid->items = malloc(grid->items_capacity * sizeof(uint32_t));
+    assert(grid->items != NULL);
+  }
+
+  // Scatter the lines, using cell_start[c] as the fill pointer of cell c, and
+  // then shift the offsets back into place.
+  for (uint32_t i = 0; i < num_lines; i++) {
+    const GridRange* r = &grid->ranges[i];
+    for (uint32_t cy = r->y0; cy <= r->y1; cy++) {
+      for (uint32_t cx = r->x0; cx <= r->x1; cx++) {
+        grid->items[cell_start[cy * grid->cols + cx]++] = i;
+      }
+    }
+  }
+  for (uint32_t c = num_cells; c > 0; c--) {
+    cell_start[c] = cell_start[c - 1];
+  }
+  cell_start[0] = 0;
+}
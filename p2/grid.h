@@ -0,0 +1,75 @@
+#ifndef GRID_H_
+#define GRID_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "linepg.h"
+
+// Cells are this many times the mean side of the lines' swept boxes. Can look
+// into tuning this value to help performance.
+#define GRID_CELL_SCALE 1.0
+
+// Upper bound on the number of cells per line, so that a scene of tiny lines
+// does not get a huge, mostly empty grid.
+#define GRID_MAX_CELLS_PER_LINE 4
+
+// Range of cells [x0, x1] x [y0, y1] covered by a line's swept box.
+struct GridRange {
+  uint32_t x0;
+  uint32_t y0;
+  uint32_t x1;
+  uint32_t y1;
+};
+typedef struct GridRange GridRange;
+
+// A uniform grid over the box, rebuilt every frame. Each line is listed in
+// every cell its swept box overlaps, and each cell's lines are contiguous.
+// Boxes that stick out of the grid are clamped to the border cells.
+struct Grid {
+  double xmin;
+  double ymin;
+  double inv_cell_size;
+  uint32_t cols;
+  uint32_t rows;
+
+  // The lines in cell c are items[cell_start[c], cell_start[c + 1]).
+  uint32_t* cell_start;
+  uint32_t cells_capacity;
+  uint32_t* items;
+  uint32_t items_capacity;
+
+  // ranges[i] is the range of cells line i is listed in.
+  GridRange* ranges;
+  uint32_t ranges_capacity;
+};
+typedef struct Grid Grid;
+
+Grid* Grid_new();
+void Grid_delete(Grid* grid);
+
+// Rebuilds grid over the box [xmin, xmax] x [ymin, ymax] from the swept boxes
+// in geom, where geom[i] is the geometry of line i. The cell size is derived
+// from the mean swept box side, and lines are placed into cells with a
+// counting sort.
+void Grid_build(Grid* grid, double xmin, double ymin, double xmax, double ymax,
+                const LineGeom* geom, uint32_t num_lines);
+
+static inline uint32_t Grid_numCells(const Grid* grid) {
+  return grid->cols * grid->rows;
+}
+
+// Returns true if cell (cx, cy) is the one cell in which the pair of lines a
+// and b, both listed in it, should be tested. A pair can share several cells;
+// this picks the lowest corner of the overlap of their ranges, so every pair
+// is tested exactly once.
+static inline bool Grid_owns(const Grid* grid, uint32_t cx, uint32_t cy,
+                             uint32_t a, uint32_t b) {
+  const GridRange* ra = &grid->ranges[a];
+  const GridRange* rb = &grid->ranges[b];
+  const uint32_t x0 = ra->x0 > rb->x0 ? ra->x0 : rb->x0;
+  const uint32_t y0 = ra->y0 > rb->y0 ? ra->y0 : rb->y0;
+  return cx == x0 && cy == y0;
+}
+
+#endif
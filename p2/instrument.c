@@ -0,0 +1,139 @@
+#include "instrument.h"
+
+#ifdef INSTRUMENT
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct Histogram {
+  uint64_t buckets[INSTRUMENT_BUCKETS];
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+};
+typedef struct Histogram Histogram;
+
+static const char* const phase_names[INSTRUMENT_NUM_PHASES] = {
+    "build", "traverse", "sort", "solve", "position", "wall",
+};
+
+// Totals since the start of the program. Everything is recorded from serial
+// code, so no synchronization is needed.
+static struct {
+  bool registered;
+  uint64_t frames;
+  Histogram phases[INSTRUMENT_NUM_PHASES];
+  // Per node, over all frames.
+  Histogram occupancy;
+  // Per frame.
+  Histogram depth;
+  Histogram root_lines;
+  Histogram candidates;
+  Histogram exact;
+  Histogram events;
+  // Of the frame in progress.
+  uint32_t frame_depth;
+  uint32_t frame_root_lines;
+  bool frame_has_tree;
+} stats;
+
+static void Instrument_dump();
+
+static void Instrument_register() {
+  if (!stats.registered) {
+    stats.registered = true;
+    atexit(Instrument_dump);
+  }
+}
+
+static void Histogram_add(Histogram* h, uint64_t value) {
+  unsigned int bucket = 0;
+  while (bucket + 1 < INSTRUMENT_BUCKETS && (value >> bucket) != 0) {
+    bucket++;
+  }
+  h->buckets[bucket]++;
+  h->count++;
+  h->sum += value;
+  if (value > h->max) h->max = value;
+}
+
+// Returns an upper bound on the p-th percentile: the upper end of the bucket
+// it falls in, or the maximum if that is smaller.
+static uint64_t Histogram_percentile(const Histogram* h, double p) {
+  const uint64_t rank = (uint64_t)(p / 100 * h->count);
+  uint64_t seen = 0;
+  for (unsigned int b = 0; b < INSTRUMENT_BUCKETS; b++) {
+    seen += h->buckets[b];
+    if (seen > rank) {
+      const uint64_t hi = b == 0 ? 0 : (UINT64_C(1) << b) - 1;
+      return hi < h->max ? hi : h->max;
+    }
+  }
+  return h->max;
+}
+
+static void Histogram_print(const char* name, const Histogram* h) {
+  if (h->count == 0) return;
+  fprintf(stderr,
+          "%-12s n=%" PRIu64 " mean=%.1f p50<=%" PRIu64 " p99<=%" PRIu64
+          " max=%" PRIu64 "\n",
+          name, h->count, (double)h->sum / h->count,
+          Histogram_percentile(h, 50), Histogram_percentile(h, 99), h->max);
+  for (unsigned int b = 0; b < INSTRUMENT_BUCKETS; b++) {
+    if (h->buckets[b] == 0) continue;
+    const uint64_t lo = b == 0 ? 0 : UINT64_C(1) << (b - 1);
+    const uint64_t hi = b == 0 ? 0 : (UINT64_C(1) << b) - 1;
+    fprintf(stderr, "  [%" PRIu64 ", %" PRIu64 "] %" PRIu64 "\n", lo, hi,
+            h->buckets[b]);
+  }
+}
+
+void Instrument_phase(InstrumentPhase phase, uint64_t cycles) {
+  Instrument_register();
+  Histogram_add(&stats.phases[phase], cycles);
+}
+
+void Instrument_quadTreeNode(uint32_t depth, uint32_t count) {
+  Instrument_register();
+  Histogram_add(&stats.occupancy, count);
+  if (depth > stats.frame_depth) stats.frame_depth = depth;
+  if (depth == 0) stats.frame_root_lines = count;
+  stats.frame_has_tree = true;
+}
+
+void Instrument_frame(uint64_t candidates, uint64_t exact, uint64_t events) {
+  Instrument_register();
+  stats.frames++;
+  if (stats.frame_has_tree) {
+    Histogram_add(&stats.depth, stats.frame_depth);
+    Histogram_add(&stats.root_lines, stats.frame_root_lines);
+  }
+  Histogram_add(&stats.candidates, candidates);
+  Histogram_add(&stats.exact, exact);
+  Histogram_add(&stats.events, events);
+  stats.frame_depth = 0;
+  stats.frame_root_lines = 0;
+  stats.frame_has_tree = false;
+}
+
+static void Instrument_dump() {
+  fprintf(stderr, "---- INSTRUMENTATION (%" PRIu64 " frames) ----\n",
+          stats.frames);
+  fprintf(stderr, "Per frame:\n");
+  Histogram_print("qt depth", &stats.depth);
+  Histogram_print("root lines", &stats.root_lines);
+  Histogram_print("candidates", &stats.candidates);
+  Histogram_print("exact tests", &stats.exact);
+  Histogram_print("events", &stats.events);
+  fprintf(stderr, "Lines per quadtree node:\n");
+  Histogram_print("occupancy", &stats.occupancy);
+  fprintf(stderr, "Cycles per phase:\n");
+  for (int p = 0; p < INSTRUMENT_NUM_PHASES; p++) {
+    Histogram_print(phase_names[p], &stats.phases[p]);
+  }
+  fprintf(stderr, "---- END INSTRUMENTATION ----\n");
+}
+
+#endif  // INSTRUMENT
@@ -0,0 +1,60 @@
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+// Algorithmic counters and cycle histograms for tuning the broad phase. They
+// are only compiled in when INSTRUMENT is defined (make INSTRUMENT=1), and are
+// dumped to stderr at exit. Wrap every use in INSTRUMENT_ONLY so that other
+// builds are unaffected.
+
+#ifdef INSTRUMENT
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define INSTRUMENT_ONLY(...) __VA_ARGS__
+
+// Histograms have one bucket for 0 and one for each [2^(b-1), 2^b).
+#define INSTRUMENT_BUCKETS 48
+
+// Phases of a frame, as in PhaseTimes.
+typedef enum {
+  INSTRUMENT_BUILD,
+  INSTRUMENT_TRAVERSE,
+  INSTRUMENT_SORT,
+  INSTRUMENT_SOLVE,
+  INSTRUMENT_POSITION,
+  INSTRUMENT_WALL,
+  INSTRUMENT_NUM_PHASES
+} InstrumentPhase;
+
+// Returns the time stamp counter, or 0 where there is none.
+static inline uint64_t Instrument_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}
+
+// Records that phase took the given number of cycles.
+void Instrument_phase(InstrumentPhase phase, uint64_t cycles);
+
+// Records a live quadtree node at depth holding count lines. Called for every
+// node after each frame's update.
+void Instrument_quadTreeNode(uint32_t depth, uint32_t count);
+
+// Ends a frame whose broad phase produced the given number of candidate pairs,
+// sent exact of them to the exact intersection test and found events
+// intersections.
+void Instrument_frame(uint64_t candidates, uint64_t exact, uint64_t events);
+
+#else
+
+#define INSTRUMENT_ONLY(...)
+
+#endif  // INSTRUMENT
+
+#endif  // INSTRUMENT_H_
@@ -23,7 +23,9 @@
 #include "./intersection_detection.h"
 
 #include <assert.h>
+#include <immintrin.h>
 
+#include "./fixed_point.h"
 #include "./line.h"
 #include "./vec.h"
 
@@ -34,8 +36,8 @@ IntersectionType intersect(Line *l1, Line *l2, double time) {
   Vec velocity;
   Vec p1;
   Vec p2;
-  Vec v1 = Vec_makeFromLine(*l1);
-  Vec v2 = Vec_makeFromLine(*l2);
+  Vec v1 = Vec_makeFromLine(l1);
+  Vec v2 = Vec_makeFromLine(l2);
 
   // Get relative velocity.
   velocity = Vec_subtract(l2->velocity, l1->velocity);
@@ -97,12 +99,177 @@ IntersectionType intersect(Line *l1, Line *l2, double time) {
   return L1_WITH_L2;
 }
 
+// ***************************** Batched intersect *****************************
+
+// Same as direction, lane by lane.
+VEC_AVX2 static inline __m256d direction4(Vec4 pi, Vec4 pj, Vec4 pk) {
+  return Vec4_crossProduct(Vec4_subtract(pk, pi), Vec4_subtract(pj, pi));
+}
+
+// All-ones in the lanes where a and b have strictly opposite signs.
+VEC_AVX2 static inline __m256d opposite4(__m256d a, __m256d b) {
+  const __m256d zero = _mm256_setzero_pd();
+  return _mm256_or_pd(_mm256_and_pd(_mm256_cmp_pd(a, zero, _CMP_GT_OQ),
+                                    _mm256_cmp_pd(b, zero, _CMP_LT_OQ)),
+                      _mm256_and_pd(_mm256_cmp_pd(a, zero, _CMP_LT_OQ),
+                                    _mm256_cmp_pd(b, zero, _CMP_GT_OQ)));
+}
+
+// All-ones in the lanes where v lies between a and b, inclusive.
+VEC_AVX2 static inline __m256d between4(__m256d a, __m256d b, __m256d v) {
+  return _mm256_or_pd(_mm256_and_pd(_mm256_cmp_pd(a, v, _CMP_LE_OQ),
+                                    _mm256_cmp_pd(v, b, _CMP_LE_OQ)),
+                      _mm256_and_pd(_mm256_cmp_pd(b, v, _CMP_LE_OQ),
+                                    _mm256_cmp_pd(v, a, _CMP_LE_OQ)));
+}
+
+// Same as onSegment, lane by lane, masked to the lanes where d is 0.
+VEC_AVX2 static inline __m256d onSegmentIf4(__m256d d, Vec4 pi, Vec4 pj,
+                                            Vec4 pk) {
+  return _mm256_and_pd(
+      _mm256_cmp_pd(d, _mm256_setzero_pd(), _CMP_EQ_OQ),
+      _mm256_and_pd(between4(pi.x, pj.x, pk.x), between4(pi.y, pj.y, pk.y)));
+}
+
+// Same as intersectLines, lane by lane.
+VEC_AVX2 static inline __m256d intersectLines4(Vec4 p1, Vec4 p2, Vec4 p3,
+                                               Vec4 p4) {
+  const __m256d d1 = direction4(p3, p4, p1);
+  const __m256d d2 = direction4(p3, p4, p2);
+  const __m256d d3 = direction4(p1, p2, p3);
+  const __m256d d4 = direction4(p1, p2, p4);
+
+  __m256d result = _mm256_and_pd(opposite4(d1, d2), opposite4(d3, d4));
+  result = _mm256_or_pd(result, onSegmentIf4(d1, p3, p4, p1));
+  result = _mm256_or_pd(result, onSegmentIf4(d2, p3, p4, p2));
+  result = _mm256_or_pd(result, onSegmentIf4(d3, p1, p2, p3));
+  result = _mm256_or_pd(result, onSegmentIf4(d4, p1, p2, p4));
+  return result;
+}
+
+// Same as pointInParallelogram, lane by lane.
+VEC_AVX2 static inline __m256d pointInParallelogram4(Vec4 point, Vec4 p1,
+                                                     Vec4 p2, Vec4 p3,
+                                                     Vec4 p4) {
+  const __m256d d1 = direction4(p1, p2, point);
+  const __m256d d2 = direction4(p3, p4, point);
+  const __m256d d3 = direction4(p1, p3, point);
+  const __m256d d4 = direction4(p2, p4, point);
+  return _mm256_and_pd(opposite4(d1, d2), opposite4(d3, d4));
+}
+
+#define VEC4_GATHER(l, field)                                              \
+  ((Vec4){.x = _mm256_set_pd(l[3]->field.x, l[2]->field.x, l[1]->field.x, \
+                             l[0]->field.x),                               \
+          .y = _mm256_set_pd(l[3]->field.y, l[2]->field.y, l[1]->field.y, \
+                             l[0]->field.y)})
+
+// intersect for the four pairs (a[k], b[k]). Decides every case except the
+// ones that need the angle between the lines, which are left to intersect.
+VEC_AVX2 static void intersect4(Line *const a[4], Line *const b[4],
+                                double time, IntersectionType out[4]) {
+  const Vec4 a1 = VEC4_GATHER(a, p1);
+  const Vec4 a2 = VEC4_GATHER(a, p2);
+  const Vec4 b1 = VEC4_GATHER(b, p1);
+  const Vec4 b2 = VEC4_GATHER(b, p2);
+  const Vec4 va = VEC4_GATHER(a, velocity);
+  const Vec4 vb = VEC4_GATHER(b, velocity);
+
+  // Get the parallelogram swept by b relative to a.
+  const Vec4 d = Vec4_multiply(Vec4_subtract(vb, va), _mm256_set1_pd(time));
+  const Vec4 p1 = Vec4_add(b1, d);
+  const Vec4 p2 = Vec4_add(b2, d);
+
+  const int already = _mm256_movemask_pd(intersectLines4(a1, a2, b1, b2));
+  const int across = _mm256_movemask_pd(intersectLines4(a1, a2, p1, p2));
+  const int top = _mm256_movemask_pd(intersectLines4(a1, a2, p1, b1));
+  const int bottom = _mm256_movemask_pd(intersectLines4(a1, a2, p2, b2));
+  const int inside =
+      _mm256_movemask_pd(_mm256_and_pd(pointInParallelogram4(a1, b1, b2, p1, p2),
+                                       pointInParallelogram4(a2, b1, b2, p1, p2)));
+
+  for (int k = 0; k < 4; k++) {
+    const int bit = 1 << k;
+    const int num_line_intersections =
+        !!(across & bit) + !!(top & bit) + !!(bottom & bit);
+    if (already & bit) {
+      out[k] = ALREADY_INTERSECTED;
+    } else if (num_line_intersections == 2) {
+      out[k] = L2_WITH_L1;
+    } else if (inside & bit) {
+      out[k] = L1_WITH_L2;
+    } else if (num_line_intersections == 0) {
+      out[k] = NO_INTERSECTION;
+    } else {
+      out[k] = intersect(a[k], b[k], time);
+    }
+  }
+}
+
+VEC_AVX2 static void intersect_batchAVX2(Line *l1, Line *const *cands,
+                                         int n, double time,
+                                         IntersectionType *out) {
+  for (int i = 0; i < n; i += 4) {
+    Line *a[4];
+    Line *b[4];
+    IntersectionType result[4];
+    const int lanes = n - i < 4 ? n - i : 4;
+    for (int k = 0; k < 4; k++) {
+      // Spare lanes repeat the last candidate.
+      Line *cand = cands[i + (k < lanes ? k : lanes - 1)];
+      if (compareLines(l1, cand) < 0) {
+        a[k] = l1;
+        b[k] = cand;
+      } else {
+        a[k] = cand;
+        b[k] = l1;
+      }
+    }
+    intersect4(a, b, time, result);
+    for (int k = 0; k < lanes; k++) {
+      out[i + k] = result[k];
+    }
+  }
+}
+
+void intersect_batch(Line *l1, Line *const *cands, int n, double time,
+                     IntersectionType *out) {
+  if (__builtin_cpu_supports("avx2")) {
+    intersect_batchAVX2(l1, cands, n, time, out);
+    return;
+  }
+  for (int i = 0; i < n; i++) {
+    out[i] = compareLines(l1, cands[i]) < 0 ? intersect(l1, cands[i], time)
+                                            : intersect(cands[i], l1, time);
+  }
+}
+
+#ifdef FIXED_POINT
+// Same as direction, exactly, on lattice coordinates.
+static inline int64_t directionFixed(FixedVec pi, FixedVec pj, FixedVec pk) {
+  return (int64_t)(pk.x - pi.x) * (pj.y - pi.y) -
+         (int64_t)(pj.x - pi.x) * (pk.y - pi.y);
+}
+#endif
+
 // Check if a point is in the parallelogram.
 bool pointInParallelogram(Vec point, Vec p1, Vec p2, Vec p3, Vec p4) {
+#ifdef FIXED_POINT
+  const FixedVec q = FixedVec_make(point);
+  const FixedVec f1 = FixedVec_make(p1);
+  const FixedVec f2 = FixedVec_make(p2);
+  const FixedVec f3 = FixedVec_make(p3);
+  const FixedVec f4 = FixedVec_make(p4);
+  int64_t d1 = directionFixed(f1, f2, q);
+  int64_t d2 = directionFixed(f3, f4, q);
+  int64_t d3 = directionFixed(f1, f3, q);
+  int64_t d4 = directionFixed(f2, f4, q);
+#else
   double d1 = direction(p1, p2, point);
   double d2 = direction(p3, p4, point);
   double d3 = direction(p1, p3, point);
   double d4 = direction(p2, p4, point);
+#endif
 
   if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0))
       && ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) {
@@ -114,10 +281,21 @@ bool pointInParallelogram(Vec point, Vec p1, Vec p2, Vec p3, Vec p4) {
 // Check if two lines intersect.
 bool intersectLines(Vec p1, Vec p2, Vec p3, Vec p4) {
   // Relative orientation
+#ifdef FIXED_POINT
+  const FixedVec f1 = FixedVec_make(p1);
+  const FixedVec f2 = FixedVec_make(p2);
+  const FixedVec f3 = FixedVec_make(p3);
+  const FixedVec f4 = FixedVec_make(p4);
+  int64_t d1 = directionFixed(f3, f4, f1);
+  int64_t d2 = directionFixed(f3, f4, f2);
+  int64_t d3 = directionFixed(f1, f2, f3);
+  int64_t d4 = directionFixed(f1, f2, f4);
+#else
   double d1 = direction(p3, p4, p1);
   double d2 = direction(p3, p4, p2);
   double d3 = direction(p1, p2, p3);
   double d4 = direction(p1, p2, p4);
+#endif
 
   // If (p1, p2) and (p3, p4) straddle each other, the line segments must
   // intersect.
@@ -152,7 +330,14 @@ Vec getIntersectionPoint(Vec p1, Vec p2, Vec p3, Vec p4) {
 
 // Check the direction of two lines (pi, pj) and (pi, pk).
 double direction(Vec pi, Vec pj, Vec pk) {
+#ifdef FIXED_POINT
+  // Scaling back by a power of two keeps the result exact.
+  return (double)directionFixed(FixedVec_make(pi), FixedVec_make(pj),
+                                FixedVec_make(pk)) /
+         ((double)FIXED_ONE * FIXED_ONE);
+#else
   return crossProduct(pk.x - pi.x, pk.y - pi.y, pj.x - pi.x, pj.y - pi.y);
+#endif
 }
 
 // Check if a point pk is in the line segment (pi, pj).
@@ -37,13 +37,21 @@ typedef enum {
 // Precondition: compareLines(l1, l2) < 0 must be true.
 IntersectionType intersect(Line *l1, Line *l2, double time);
 
+// Tests l1 against n candidate lines at once: out[i] is intersect(l1,
+// cands[i], time) if compareLines(l1, cands[i]) < 0 and intersect(cands[i],
+// l1, time) otherwise. On CPUs with AVX2, candidates are tested four at a
+// time and only the few pairs that need the angle test go through intersect.
+void intersect_batch(Line *l1, Line *const *cands, int n, double time,
+                     IntersectionType *out);
+
 // Check if a point is in the parallelogram.
 bool pointInParallelogram(Vec point, Vec p1, Vec p2, Vec p3, Vec p4);
 
 // Check if two lines intersect.
 bool intersectLines(Vec p1, Vec p2, Vec p3, Vec p4);
 
-// Check the direction of two lines (pi, pj) and (pi, pk).
+// Check the direction of two lines (pi, pj) and (pi, pk). Exact in
+// fixed-point builds (see fixed_point.h).
 double direction(Vec pi, Vec pj, Vec pk);
 
 // Check if a point pk is in the line segment (pi, pj).
@@ -23,82 +23,153 @@
 #include "./intersection_event_list.h"
 
 #include <assert.h>
+#include <cilk/cilk.h>
 #include <stdlib.h>
+#include <string.h>
 
-int IntersectionEventNode_compareData(IntersectionEventNode* node1,
-                                      IntersectionEventNode* node2) {
-  if (compareLines(node1->l1, node2->l1) < 0) {
-    return -1;
-  } else if (compareLines(node1->l1, node2->l1) == 0) {
-    if (compareLines(node1->l2, node2->l2) < 0) {
-      return -1;
-    } else if (compareLines(node1->l2, node2->l2) == 0) {
-      return 0;
-    } else {
-      return 1;
-    }
-  } else {
-    return 1;
-  }
-}
+// The radix sort handles keys RADIX_BITS at a time.
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
 
-void IntersectionEventNode_swapData(IntersectionEventNode* node1,
-                                    IntersectionEventNode* node2) {
-  {
-    Line* temp = node1->l1;
-    node1->l1 = node2->l1;
-    node2->l1 = temp;
-  }
-  {
-    Line* temp = node1->l2;
-    node1->l2 = node2->l2;
-    node2->l2 = temp;
-  }
-  {
-    IntersectionType temp = node1->intersectionType;
-    node1->intersectionType = node2->intersectionType;
-    node2->intersectionType = temp;
-  }
-}
+// Lists with at least this many events are sorted in parallel, split into
+// RADIX_BLOCKS blocks that are counted and scattered independently.
+#define RADIX_PARALLEL_THRESHOLD (1 << 14)
+#define RADIX_BLOCKS 64
 
 IntersectionEventList IntersectionEventList_make() {
   IntersectionEventList intersectionEventList;
-  intersectionEventList.head = NULL;
-  intersectionEventList.tail = NULL;
+  intersectionEventList.events = NULL;
+  intersectionEventList.size = 0;
+  intersectionEventList.capacity = 0;
   return intersectionEventList;
 }
 
+// Makes room for at least extra more events.
+static void IntersectionEventList_reserve(
+    IntersectionEventList* intersectionEventList, size_t extra) {
+  const size_t needed = intersectionEventList->size + extra;
+  if (needed <= intersectionEventList->capacity) {
+    return;
+  }
+  size_t capacity = intersectionEventList->capacity == 0
+                        ? 64
+                        : 2 * intersectionEventList->capacity;
+  if (capacity < needed) {
+    capacity = needed;
+  }
+  IntersectionEvent* events = realloc(intersectionEventList->events,
+                                      capacity * sizeof(IntersectionEvent));
+  assert(events != NULL);
+  intersectionEventList->events = events;
+  intersectionEventList->capacity = capacity;
+}
+
 void IntersectionEventList_appendNode(
     IntersectionEventList* intersectionEventList, Line* l1, Line* l2,
     IntersectionType intersectionType) {
   assert(compareLines(l1, l2) < 0);
 
-  IntersectionEventNode* newNode = malloc(sizeof(IntersectionEventNode));
-  if (newNode == NULL) {
+  IntersectionEventList_reserve(intersectionEventList, 1);
+  intersectionEventList->events[intersectionEventList->size++] =
+      (IntersectionEvent){
+          .key = IntersectionEvent_key(l1, l2),
+          .l1 = l1,
+          .l2 = l2,
+          .intersectionType = intersectionType,
+      };
+}
+
+void IntersectionEventList_concat(IntersectionEventList* left,
+                                  IntersectionEventList* right) {
+  if (left->size == 0) {
+    // Just take right's array.
+    IntersectionEventList tmp = *left;
+    *left = *right;
+    *right = tmp;
+  } else if (right->size > 0) {
+    IntersectionEventList_reserve(left, right->size);
+    memcpy(left->events + left->size, right->events,
+           right->size * sizeof(IntersectionEvent));
+    left->size += right->size;
+  }
+  IntersectionEventList_deleteNodes(right);
+}
+
+// Range of events [begin, end) handled by block b of num_blocks.
+static inline size_t radix_block_begin(size_t n, size_t b, size_t num_blocks) {
+  return n * b / num_blocks;
+}
+
+void IntersectionEventList_sort(IntersectionEventList* intersectionEventList) {
+  const size_t n = intersectionEventList->size;
+  if (n < 2) {
     return;
   }
 
-  newNode->l1 = l1;
-  newNode->l2 = l2;
-  newNode->intersectionType = intersectionType;
-  newNode->next = NULL;
-  if (intersectionEventList->head == NULL) {
-    intersectionEventList->head = newNode;
+  const size_t num_blocks = n >= RADIX_PARALLEL_THRESHOLD ? RADIX_BLOCKS : 1;
+  size_t(*counts)[RADIX_BUCKETS] =
+      malloc(num_blocks * sizeof(size_t[RADIX_BUCKETS]));
+  IntersectionEvent* src = intersectionEventList->events;
+  IntersectionEvent* dst = malloc(n * sizeof(IntersectionEvent));
+  assert(counts != NULL && dst != NULL);
+
+  for (int shift = 0; shift < 64; shift += RADIX_BITS) {
+    // Count the digits in each block.
+    cilk_for (size_t b = 0; b < num_blocks; b++) {
+      memset(counts[b], 0, sizeof(counts[b]));
+      const size_t end = radix_block_begin(n, b + 1, num_blocks);
+      for (size_t i = radix_block_begin(n, b, num_blocks); i < end; i++) {
+        counts[b][(src[i].key >> shift) & (RADIX_BUCKETS - 1)]++;
+      }
+    }
+
+    // Skip digits that every key shares; with line IDs well below 2^32 most
+    // of the high digits are zero.
+    const unsigned int digit = (src[0].key >> shift) & (RADIX_BUCKETS - 1);
+    size_t same = 0;
+    for (size_t b = 0; b < num_blocks; b++) {
+      same += counts[b][digit];
+    }
+    if (same == n) {
+      continue;
+    }
+
+    // Turn the counts into each block's starting offset for each digit,
+    // ordered by digit, then block, to keep the sort stable.
+    size_t offset = 0;
+    for (unsigned int d = 0; d < RADIX_BUCKETS; d++) {
+      for (size_t b = 0; b < num_blocks; b++) {
+        const size_t count = counts[b][d];
+        counts[b][d] = offset;
+        offset += count;
+      }
+    }
+
+    cilk_for (size_t b = 0; b < num_blocks; b++) {
+      const size_t end = radix_block_begin(n, b + 1, num_blocks);
+      for (size_t i = radix_block_begin(n, b, num_blocks); i < end; i++) {
+        dst[counts[b][(src[i].key >> shift) & (RADIX_BUCKETS - 1)]++] = src[i];
+      }
+    }
+
+    IntersectionEvent* tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  // src holds the sorted events; keep whichever buffer that is.
+  if (src != intersectionEventList->events) {
+    free(intersectionEventList->events);
+    intersectionEventList->events = src;
+    intersectionEventList->capacity = n;
   } else {
-    intersectionEventList->tail->next = newNode;
+    free(dst);
   }
-  intersectionEventList->tail = newNode;
+  free(counts);
 }
 
 void IntersectionEventList_deleteNodes(
     IntersectionEventList* intersectionEventList) {
-  IntersectionEventNode* curNode = intersectionEventList->head;
-  IntersectionEventNode* nextNode = NULL;
-  while (curNode != NULL) {
-    nextNode = curNode->next;
-    free(curNode);
-    curNode = nextNode;
-  }
-  intersectionEventList->head = NULL;
-  intersectionEventList->tail = NULL;
+  free(intersectionEventList->events);
+  *intersectionEventList = IntersectionEventList_make();
 }
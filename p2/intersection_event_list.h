@@ -23,45 +23,54 @@
 #ifndef INTERSECTIONEVENTLIST_H_
 #define INTERSECTIONEVENTLIST_H_
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "./line.h"
 #include "./intersection_detection.h"
 
-struct IntersectionEventNode {
-  // This IntersectionEventNode does not own these Line* lines.
+struct IntersectionEvent {
+  // l1's line ID in the high half and l2's in the low half, so that sorting
+  // by key orders events by l1's ID, then l2's ID.
+  uint64_t key;
+  // This IntersectionEvent does not own these Line* lines.
   Line* l1;
   Line* l2;
   IntersectionType intersectionType;
-  struct IntersectionEventNode* next;
 };
-typedef struct IntersectionEventNode IntersectionEventNode;
-
-// Compares the nodes by l1's line ID, then l1's line ID.
-// -1 <=> node1 ordered before node2
-//  0 <=> node1 ordered the same as node2
-//  1 <=> node1 ordered after node2
-int IntersectionEventNode_compareData(IntersectionEventNode* node1,
-                                      IntersectionEventNode* node2);
+typedef struct IntersectionEvent IntersectionEvent;
 
-// Swaps the node1's and node2's data (l1, l2, intersectionType).
-void IntersectionEventNode_swapData(IntersectionEventNode* node1,
-                                    IntersectionEventNode* node2);
+// Returns the sort key of the event between l1 and l2.
+static inline uint64_t IntersectionEvent_key(const Line* l1, const Line* l2) {
+  return ((uint64_t)l1->id << 32) | l2->id;
+}
 
+// Growable array of intersection events.
 struct IntersectionEventList {
-  IntersectionEventNode* head;
-  IntersectionEventNode* tail;
+  IntersectionEvent* events;
+  size_t size;
+  size_t capacity;
 };
 typedef struct IntersectionEventList IntersectionEventList;
 
 // Returns an empty list.
 IntersectionEventList IntersectionEventList_make();
 
-// Appends a new node to the list with the data (l1, l2, intersectionType).
+// Appends a new event to the list with the data (l1, l2, intersectionType).
 // Precondition: compareLines(l1, l2) < 0 must be true.
 void IntersectionEventList_appendNode(
     IntersectionEventList* intersectionEventList, Line* l1, Line* l2,
     IntersectionType intersectionType);
 
-// Deletes all the nodes in the list.
+// Moves all the events of right to the end of left, leaving right empty.
+void IntersectionEventList_concat(IntersectionEventList* left,
+                                  IntersectionEventList* right);
+
+// Sorts the events by l1's line ID, then l2's line ID, using an LSD radix
+// sort on the event keys. Large lists are sorted in parallel.
+void IntersectionEventList_sort(IntersectionEventList* intersectionEventList);
+
+// Deletes all the events in the list.
 void IntersectionEventList_deleteNodes(
     IntersectionEventList* intersectionEventList);
 
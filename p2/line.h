@@ -63,6 +63,12 @@ struct Line {
 };
 typedef struct Line Line;
 
+// Returns a vector parallel to the provided Line.  The direction of the
+// vector is unspecified.
+static inline Vec Vec_makeFromLine(const Line *line) {
+  return Vec_subtract(line->p1, line->p2);
+}
+
 // Compares the lines by line ID.
 // -1 <=> line1 ordered before line2
 //  0 <=> line1 ordered the same as line2
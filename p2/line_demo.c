@@ -30,6 +30,7 @@
 
 #include "./graphic_stuff.h"
 #include "./line.h"
+#include "./scene.h"
 
 static char* LineDemo_input_file_path;
 
@@ -54,50 +55,13 @@ void LineDemo_delete(LineDemo* lineDemo) {
   free(lineDemo);
 }
 
-// Read in lines from line.in and add them into collision world for simulation.
+// Read in lines from the input file, in the text or the binary scene format,
+// into a new collision world for simulation.
 void LineDemo_createLines(LineDemo* lineDemo) {
-  unsigned int lineId = 0;
-  unsigned int numOfLines;
-  window_dimension px1;
-  window_dimension py1;
-  window_dimension px2;
-  window_dimension py2;
-  window_dimension vx;
-  window_dimension vy;
-  int isGray;
-  FILE *fin;
-  fin = fopen(LineDemo_input_file_path, "r");
-  if (fin == NULL) {
-    fprintf(stderr, "Input file not found (%s)\n", LineDemo_input_file_path);
+  lineDemo->collisionWorld = Scene_load(LineDemo_input_file_path);
+  if (lineDemo->collisionWorld == NULL) {
     exit(1);
   }
-
-  fscanf(fin, "%d\n", &numOfLines);
-  lineDemo->collisionWorld = CollisionWorld_new(numOfLines);
-
-  while (EOF
-      != fscanf(fin, "(%lf, %lf), (%lf, %lf), %lf, %lf, %d\n", &px1, &py1, &px2,
-                &py2, &vx, &vy, &isGray)) {
-    Line *line = malloc(sizeof(Line));
-
-    // convert window coordinates to box coordinates
-    windowToBox(&line->p1.x, &line->p1.y, px1, py1);
-    windowToBox(&line->p2.x, &line->p2.y, px2, py2);
-
-    // convert window velocity to box velocity
-    velocityWindowToBox(&line->velocity.x, &line->velocity.y, vx, vy);
-
-    // store color
-    line->color = (Color) isGray;
-
-    // store line ID
-    line->id = lineId;
-    lineId++;
-
-    // transfer ownership of line to collisionWorld
-    CollisionWorld_addLine(lineDemo->collisionWorld, line);
-  }
-  fclose(fin);
 }
 
 void LineDemo_setNumFrames(LineDemo* lineDemo, const unsigned int numFrames) {
@@ -108,6 +72,18 @@ void LineDemo_initLine(LineDemo* lineDemo) {
   LineDemo_createLines(lineDemo);
 }
 
+void LineDemo_useSoA(LineDemo* lineDemo) {
+  CollisionWorld_enableSoA(lineDemo->collisionWorld);
+}
+
+void LineDemo_setBroadPhase(LineDemo* lineDemo, BroadPhase broadPhase) {
+  CollisionWorld_setBroadPhase(lineDemo->collisionWorld, broadPhase);
+}
+
+void LineDemo_setQuadTreeParams(LineDemo* lineDemo, QuadTreeParams params) {
+  CollisionWorld_setQuadTreeParams(lineDemo->collisionWorld, params);
+}
+
 Line* LineDemo_getLine(LineDemo* lineDemo, const unsigned int index) {
   return CollisionWorld_getLine(lineDemo->collisionWorld, index);
 }
@@ -124,6 +100,14 @@ unsigned int LineDemo_getNumLineLineCollisions(LineDemo* lineDemo) {
   return CollisionWorld_getNumLineLineCollisions(lineDemo->collisionWorld);
 }
 
+uint64_t LineDemo_getNumPairsRejected(LineDemo* lineDemo) {
+  return CollisionWorld_getNumPairsRejected(lineDemo->collisionWorld);
+}
+
+uint64_t LineDemo_getNumPairsTested(LineDemo* lineDemo) {
+  return CollisionWorld_getNumPairsTested(lineDemo->collisionWorld);
+}
+
 // The main simulation loop
 bool LineDemo_update(LineDemo* lineDemo) {
   lineDemo->count++;
@@ -51,6 +51,16 @@ void LineDemo_setNumFrames(LineDemo* lineDemo, const unsigned int numFrames);
 // Initialize line simulation.
 void LineDemo_initLine(LineDemo* lineDemo);
 
+// Store lines in structure-of-arrays form. Call after LineDemo_initLine.
+void LineDemo_useSoA(LineDemo* lineDemo);
+
+// Select the broad phase used to find candidate pairs. Call after
+// LineDemo_initLine.
+void LineDemo_setBroadPhase(LineDemo* lineDemo, BroadPhase broadPhase);
+
+// Set the shape of the quadtree broad phase. Call after LineDemo_initLine.
+void LineDemo_setQuadTreeParams(LineDemo* lineDemo, QuadTreeParams params);
+
 // Get ith line.
 Line* LineDemo_getLine(LineDemo* lineDemo, const unsigned int index);
 
@@ -63,6 +73,12 @@ unsigned int LineDemo_getNumLineWallCollisions(LineDemo* lineDemo);
 // Get number of line-line collisions.
 unsigned int LineDemo_getNumLineLineCollisions(LineDemo* lineDemo);
 
+// Get number of candidate pairs rejected by the swept bounding box test.
+uint64_t LineDemo_getNumPairsRejected(LineDemo* lineDemo);
+
+// Get number of candidate pairs passed on to the exact intersection test.
+uint64_t LineDemo_getNumPairsTested(LineDemo* lineDemo);
+
 // Line simulation update function.
 bool LineDemo_update(LineDemo* lineDemo);
 
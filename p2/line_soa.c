@@ -0,0 +1,205 @@
+#include "./line_soa.h"
+
+#include <assert.h>
+#include <cilk/cilk.h>
+#include <immintrin.h>
+#include <stdlib.h>
+
+// Alignment of each array, one AVX2 vector.
+#define LINE_SOA_ALIGN 32
+
+static double* LineSoA_newArray(const unsigned int padded, const double fill) {
+  double* array = NULL;
+  int err = posix_memalign((void**)&array, LINE_SOA_ALIGN,
+                           padded * sizeof(double));
+  assert(err == 0);
+  (void)err;
+  for (unsigned int i = 0; i < padded; i++) {
+    array[i] = fill;
+  }
+  return array;
+}
+
+LineSoA* LineSoA_new(const unsigned int numOfLines) {
+  LineSoA* soa = malloc(sizeof(LineSoA));
+  if (soa == NULL) {
+    return NULL;
+  }
+  const unsigned int padded =
+      (numOfLines + LINE_SOA_PAD - 1) / LINE_SOA_PAD * LINE_SOA_PAD;
+  const double xmid = (BOX_XMIN + BOX_XMAX) / 2.0;
+  const double ymid = (BOX_YMIN + BOX_YMAX) / 2.0;
+  *soa = (LineSoA){
+      .x1 = LineSoA_newArray(padded, xmid),
+      .y1 = LineSoA_newArray(padded, ymid),
+      .x2 = LineSoA_newArray(padded, xmid),
+      .y2 = LineSoA_newArray(padded, ymid),
+      .vx = LineSoA_newArray(padded, 0),
+      .vy = LineSoA_newArray(padded, 0),
+      .numOfLines = numOfLines,
+      .padded = padded,
+  };
+  return soa;
+}
+
+void LineSoA_delete(LineSoA* soa) {
+  if (soa == NULL) return;
+  free(soa->x1);
+  free(soa->y1);
+  free(soa->x2);
+  free(soa->y2);
+  free(soa->vx);
+  free(soa->vy);
+  free(soa);
+}
+
+void LineSoA_store(LineSoA* soa, Line* const* lines) {
+  for (unsigned int i = 0; i < soa->numOfLines; i++) {
+    const Line* line = lines[i];
+    soa->x1[i] = line->p1.x;
+    soa->y1[i] = line->p1.y;
+    soa->x2[i] = line->p2.x;
+    soa->y2[i] = line->p2.y;
+    soa->vx[i] = line->velocity.x;
+    soa->vy[i] = line->velocity.y;
+  }
+}
+
+void LineSoA_storeVelocity(LineSoA* soa, const unsigned int index,
+                           const Vec velocity) {
+  assert(index < soa->numOfLines);
+  soa->vx[index] = velocity.x;
+  soa->vy[index] = velocity.y;
+}
+
+void LineSoA_loadLine(const LineSoA* soa, const unsigned int index,
+                      Line* line) {
+  assert(index < soa->numOfLines);
+  line->p1 = Vec_make(soa->x1[index], soa->y1[index]);
+  line->p2 = Vec_make(soa->x2[index], soa->y2[index]);
+  line->velocity = Vec_make(soa->vx[index], soa->vy[index]);
+}
+
+void LineSoA_load(const LineSoA* soa, Line* const* lines) {
+  cilk_for (unsigned int i = 0; i < soa->numOfLines; i++) {
+    LineSoA_loadLine(soa, i, lines[i]);
+  }
+}
+
+// Scalar kernels, used when the CPU lacks AVX2. They do exactly what
+// CollisionWorld_updatePosition and CollisionWorld_lineWallCollision do.
+
+static void LineSoA_updatePositionScalar(LineSoA* soa, const double t) {
+  for (unsigned int i = 0; i < soa->padded; i++) {
+    soa->x1[i] += soa->vx[i] * t;
+    soa->y1[i] += soa->vy[i] * t;
+    soa->x2[i] += soa->vx[i] * t;
+    soa->y2[i] += soa->vy[i] * t;
+  }
+}
+
+static unsigned int LineSoA_lineWallCollisionScalar(LineSoA* soa) {
+  unsigned int collisions = 0;
+  for (unsigned int i = 0; i < soa->padded; i++) {
+    bool collide = false;
+    // Right side
+    if ((soa->x1[i] > BOX_XMAX || soa->x2[i] > BOX_XMAX) && soa->vx[i] > 0) {
+      soa->vx[i] = -soa->vx[i];
+      collide = true;
+    }
+    // Left side
+    if ((soa->x1[i] < BOX_XMIN || soa->x2[i] < BOX_XMIN) && soa->vx[i] < 0) {
+      soa->vx[i] = -soa->vx[i];
+      collide = true;
+    }
+    // Top side
+    if ((soa->y1[i] > BOX_YMAX || soa->y2[i] > BOX_YMAX) && soa->vy[i] > 0) {
+      soa->vy[i] = -soa->vy[i];
+      collide = true;
+    }
+    // Bottom side
+    if ((soa->y1[i] < BOX_YMIN || soa->y2[i] < BOX_YMIN) && soa->vy[i] < 0) {
+      soa->vy[i] = -soa->vy[i];
+      collide = true;
+    }
+    collisions += collide;
+  }
+  return collisions;
+}
+
+// AVX2 kernels, 4 lines per vector. Multiplies and adds are kept separate so
+// results match the scalar code bit for bit.
+
+VEC_AVX2 static void LineSoA_updatePositionAVX2(LineSoA* soa, const double t) {
+  const __m256d vt = _mm256_set1_pd(t);
+  for (unsigned int i = 0; i < soa->padded; i += 4) {
+    const Vec4 d = Vec4_multiply(Vec4_load(soa->vx + i, soa->vy + i), vt);
+    Vec4_store(soa->x1 + i, soa->y1 + i,
+               Vec4_add(Vec4_load(soa->x1 + i, soa->y1 + i), d));
+    Vec4_store(soa->x2 + i, soa->y2 + i,
+               Vec4_add(Vec4_load(soa->x2 + i, soa->y2 + i), d));
+  }
+}
+
+// Negates the lanes of v selected by mask.
+VEC_AVX2 static inline __m256d negate_where(const __m256d v,
+                                            const __m256d mask) {
+  return _mm256_xor_pd(v, _mm256_and_pd(mask, _mm256_set1_pd(-0.0)));
+}
+
+// Reflects v in the lanes where either endpoint coordinate is past the wall
+// at bound, outside being the side given by cmp, and v points further
+// outside. Each wall sees the velocity left by the previous one, like the
+// scalar code.
+#define LINE_SOA_REFLECT(v, c1, c2, bound, cmp, collide)                    \
+  do {                                                                      \
+    const __m256d past = _mm256_or_pd(_mm256_cmp_pd(c1, bound, cmp),        \
+                                      _mm256_cmp_pd(c2, bound, cmp));       \
+    const __m256d outward = _mm256_cmp_pd(v, zero, cmp);                    \
+    const __m256d hit = _mm256_and_pd(past, outward);                       \
+    v = negate_where(v, hit);                                               \
+    collide = _mm256_or_pd(collide, hit);                                   \
+  } while (0)
+
+VEC_AVX2 static unsigned int LineSoA_lineWallCollisionAVX2(LineSoA* soa) {
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d xmax = _mm256_set1_pd(BOX_XMAX);
+  const __m256d xmin = _mm256_set1_pd(BOX_XMIN);
+  const __m256d ymax = _mm256_set1_pd(BOX_YMAX);
+  const __m256d ymin = _mm256_set1_pd(BOX_YMIN);
+  unsigned int collisions = 0;
+  for (unsigned int i = 0; i < soa->padded; i += 4) {
+    const __m256d x1 = _mm256_load_pd(soa->x1 + i);
+    const __m256d x2 = _mm256_load_pd(soa->x2 + i);
+    const __m256d y1 = _mm256_load_pd(soa->y1 + i);
+    const __m256d y2 = _mm256_load_pd(soa->y2 + i);
+    __m256d vx = _mm256_load_pd(soa->vx + i);
+    __m256d vy = _mm256_load_pd(soa->vy + i);
+    __m256d collide = zero;
+
+    LINE_SOA_REFLECT(vx, x1, x2, xmax, _CMP_GT_OQ, collide);  // Right side
+    LINE_SOA_REFLECT(vx, x1, x2, xmin, _CMP_LT_OQ, collide);  // Left side
+    LINE_SOA_REFLECT(vy, y1, y2, ymax, _CMP_GT_OQ, collide);  // Top side
+    LINE_SOA_REFLECT(vy, y1, y2, ymin, _CMP_LT_OQ, collide);  // Bottom side
+
+    _mm256_store_pd(soa->vx + i, vx);
+    _mm256_store_pd(soa->vy + i, vy);
+    collisions += __builtin_popcount(_mm256_movemask_pd(collide));
+  }
+  return collisions;
+}
+
+void LineSoA_updatePosition(LineSoA* soa, const double t) {
+  if (__builtin_cpu_supports("avx2")) {
+    LineSoA_updatePositionAVX2(soa, t);
+  } else {
+    LineSoA_updatePositionScalar(soa, t);
+  }
+}
+
+unsigned int LineSoA_lineWallCollision(LineSoA* soa) {
+  if (__builtin_cpu_supports("avx2")) {
+    return LineSoA_lineWallCollisionAVX2(soa);
+  }
+  return LineSoA_lineWallCollisionScalar(soa);
+}
@@ -0,0 +1,49 @@
+#ifndef LINE_SOA_H_
+#define LINE_SOA_H_
+
+#include "./line.h"
+
+// Arrays are padded to a multiple of this many lines so that kernels can work
+// on whole vectors of 4 doubles.
+#define LINE_SOA_PAD 4
+
+// Structure-of-arrays copy of the lines' endpoints and velocities, laid out
+// for the SIMD position and wall updates. Entry i belongs to line i of the
+// CollisionWorld. Padding entries sit still in the middle of the box.
+struct LineSoA {
+  double* x1;
+  double* y1;
+  double* x2;
+  double* y2;
+  double* vx;
+  double* vy;
+  unsigned int numOfLines;
+  // Length of each array, a multiple of LINE_SOA_PAD.
+  unsigned int padded;
+};
+typedef struct LineSoA LineSoA;
+
+LineSoA* LineSoA_new(const unsigned int numOfLines);
+void LineSoA_delete(LineSoA* soa);
+
+// Copies endpoints and velocities of lines into soa.
+void LineSoA_store(LineSoA* soa, Line* const* lines);
+
+// Sets the velocity of entry index of soa.
+void LineSoA_storeVelocity(LineSoA* soa, const unsigned int index,
+                           const Vec velocity);
+
+// Copies the endpoints and velocity of entry index of soa into line.
+void LineSoA_loadLine(const LineSoA* soa, const unsigned int index, Line* line);
+
+// Copies endpoints and velocities of soa into lines.
+void LineSoA_load(const LineSoA* soa, Line* const* lines);
+
+// Moves every line by its velocity times t.
+void LineSoA_updatePosition(LineSoA* soa, const double t);
+
+// Reflects lines off the walls they are past and moving towards. Returns the
+// number of lines that bounced.
+unsigned int LineSoA_lineWallCollision(LineSoA* soa);
+
+#endif  // LINE_SOA_H_
@@ -0,0 +1,262 @@
+#include "linear_quadtree.h"
+
+#include <assert.h>
+#include <cilk/cilk.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// The radix sort handles keys LQT_RADIX_BITS at a time. Keys have
+// 2 * LQT_MAX_LEVEL + LQT_LEVEL_BITS significant bits.
+#define LQT_RADIX_BITS 8
+#define LQT_RADIX_BUCKETS (1 << LQT_RADIX_BITS)
+#define LQT_KEY_BITS (2 * LQT_MAX_LEVEL + LQT_LEVEL_BITS)
+
+// Trees with at least this many lines are sorted in parallel, split into
+// LQT_RADIX_BLOCKS blocks that are counted and scattered independently.
+#define LQT_PARALLEL_THRESHOLD (1 << 14)
+#define LQT_RADIX_BLOCKS 64
+
+LinearQuadTree* LinearQuadTree_new() {
+  LinearQuadTree* lqt = malloc(sizeof(LinearQuadTree));
+  *lqt = (LinearQuadTree){
+      .xmin = 0,
+      .ymin = 0,
+      .x_scale = 0,
+      .y_scale = 0,
+      .entries = NULL,
+      .ids = NULL,
+      .num_lines = 0,
+      .capacity = 0,
+      .scratch = NULL,
+  };
+  return lqt;
+}
+
+void LinearQuadTree_delete(LinearQuadTree* lqt) {
+  if (lqt == NULL) return;
+  free(lqt->entries);
+  free(lqt->ids);
+  free(lqt->scratch);
+  free(lqt);
+}
+
+// Returns the deepest-level column or row of coordinate v, clamped to the
+// box.
+static inline uint32_t LinearQuadTree_coord(double v, double origin,
+                                            double scale) {
+  const double c = floor((v - origin) * scale);
+  if (!(c > 0)) return 0;
+  if (c >= (1u << LQT_MAX_LEVEL) - 1) return (1u << LQT_MAX_LEVEL) - 1;
+  return (uint32_t)c;
+}
+
+// Spreads the low 16 bits of v out to the even bits.
+static inline uint32_t LinearQuadTree_spread(uint32_t v) {
+  v &= 0xFFFF;
+  v = (v | (v << 8)) & 0x00FF00FF;
+  v = (v | (v << 4)) & 0x0F0F0F0F;
+  v = (v | (v << 2)) & 0x33333333;
+  v = (v | (v << 1)) & 0x55555555;
+  return v;
+}
+
+// Deepest-level cells [x0, x1] x [y0, y1] covered by a swept box.
+struct LQTRange {
+  uint32_t x0;
+  uint32_t y0;
+  uint32_t x1;
+  uint32_t y1;
+};
+typedef struct LQTRange LQTRange;
+
+static inline LQTRange LinearQuadTree_range(const LinearQuadTree* lqt,
+                                            const LineGeom* g) {
+  return (LQTRange){
+      .x0 = LinearQuadTree_coord(g->xmin, lqt->xmin, lqt->x_scale),
+      .y0 = LinearQuadTree_coord(g->ymin, lqt->ymin, lqt->y_scale),
+      .x1 = LinearQuadTree_coord(g->xmax, lqt->xmin, lqt->x_scale),
+      .y1 = LinearQuadTree_coord(g->ymax, lqt->ymin, lqt->y_scale),
+  };
+}
+
+// Returns the key of the smallest cell containing the box g.
+static inline uint64_t LinearQuadTree_key(const LinearQuadTree* lqt,
+                                          const LineGeom* g) {
+  const LQTRange r = LinearQuadTree_range(lqt, g);
+  // The corners share the cell of every level down to the highest bit in
+  // which their coordinates differ.
+  const uint32_t diff = (r.x0 ^ r.x1) | (r.y0 ^ r.y1);
+  const uint32_t depth_lost = diff == 0 ? 0 : 32 - __builtin_clz(diff);
+  const uint32_t level = LQT_MAX_LEVEL - depth_lost;
+  const uint32_t mask = ~((1u << depth_lost) - 1);
+  const uint64_t code = ((uint64_t)LinearQuadTree_spread(r.y0 & mask) << 1) |
+                        LinearQuadTree_spread(r.x0 & mask);
+  return (code << LQT_LEVEL_BITS) | level;
+}
+
+// Returns the first entry in [lo, hi) whose key is at least key.
+static inline uint32_t LinearQuadTree_lowerBound(const LinearQuadTree* lqt,
+                                                 uint32_t lo, uint32_t hi,
+                                                 uint64_t key) {
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (lqt->entries[mid].key < key) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Appends to ids the lines of the cells strictly inside the cell at (x, y)
+// of the given level that overlap r. Entries [lo, hi) are those cells' lines.
+static uint32_t LinearQuadTree_collect(const LinearQuadTree* lqt,
+                                       const LQTRange* r, uint32_t x,
+                                       uint32_t y, uint32_t level, uint32_t lo,
+                                       uint32_t hi, uint32_t* ids) {
+  if (lo == hi || level == LQT_MAX_LEVEL) {
+    return 0;
+  }
+  const uint32_t half = 1u << (LQT_MAX_LEVEL - level - 1);
+  const uint64_t code =
+      ((uint64_t)LinearQuadTree_spread(y) << 1) | LinearQuadTree_spread(x);
+  const uint64_t quarter = (uint64_t)half * half;
+  uint32_t num_ids = 0;
+  for (uint32_t q = 0; q < 4; q++) {
+    const uint64_t child = code + q * quarter;
+    const uint32_t begin =
+        q == 0 ? lo
+               : LinearQuadTree_lowerBound(lqt, lo, hi,
+                                           child << LQT_LEVEL_BITS);
+    const uint32_t end =
+        q == 3 ? hi
+               : LinearQuadTree_lowerBound(lqt, begin, hi,
+                                           (child + quarter) << LQT_LEVEL_BITS);
+    const uint32_t cx = x + (q & 1) * half;
+    const uint32_t cy = y + (q >> 1) * half;
+    if (begin == end || r->x1 < cx || r->x0 >= cx + half || r->y1 < cy ||
+        r->y0 >= cy + half) {
+      lo = end;
+      continue;
+    }
+    // The child's own lines come first, then those of its subtree.
+    const uint64_t own = (child << LQT_LEVEL_BITS) | (level + 1);
+    uint32_t k = begin;
+    for (; k < end && lqt->entries[k].key == own; k++) {
+      ids[num_ids++] = lqt->ids[k];
+    }
+    num_ids += LinearQuadTree_collect(lqt, r, cx, cy, level + 1, k, end,
+                                      ids + num_ids);
+    lo = end;
+  }
+  return num_ids;
+}
+
+uint32_t LinearQuadTree_candidates(const LinearQuadTree* lqt, uint32_t i,
+                                   const LineGeom* geom, uint32_t* ids) {
+  const uint64_t key = lqt->entries[i].key;
+  const uint32_t level = key & ((1u << LQT_LEVEL_BITS) - 1);
+  const uint32_t end = LinearQuadTree_subtreeEnd(lqt, i);
+  uint32_t num_ids = 0;
+  uint32_t k = i + 1;
+  for (; k < end && lqt->entries[k].key == key; k++) {
+    ids[num_ids++] = lqt->ids[k];
+  }
+  if (k == end) {
+    return num_ids;
+  }
+  const LQTRange r = LinearQuadTree_range(lqt, &geom[lqt->entries[i].id]);
+  const uint32_t mask = ~((1u << (LQT_MAX_LEVEL - level)) - 1);
+  return num_ids + LinearQuadTree_collect(lqt, &r, r.x0 & mask, r.y0 & mask,
+                                          level, k, end, ids + num_ids);
+}
+
+// Range of entries [begin, end) handled by block b of num_blocks.
+static inline uint32_t LinearQuadTree_blockBegin(uint32_t n, uint32_t b,
+                                                 uint32_t num_blocks) {
+  return (uint64_t)n * b / num_blocks;
+}
+
+// Sorts the entries of lqt by key with an LSD radix sort.
+static void LinearQuadTree_sort(LinearQuadTree* const lqt) {
+  const uint32_t n = lqt->num_lines;
+  const uint32_t num_blocks =
+      n >= LQT_PARALLEL_THRESHOLD ? LQT_RADIX_BLOCKS : 1;
+  uint32_t(*counts)[LQT_RADIX_BUCKETS] =
+      malloc(num_blocks * sizeof(uint32_t[LQT_RADIX_BUCKETS]));
+  assert(counts != NULL);
+  LQTEntry* src = lqt->entries;
+  LQTEntry* dst = lqt->scratch;
+
+  for (int shift = 0; shift < LQT_KEY_BITS; shift += LQT_RADIX_BITS) {
+    cilk_for (uint32_t b = 0; b < num_blocks; b++) {
+      memset(counts[b], 0, sizeof(counts[b]));
+      const uint32_t end = LinearQuadTree_blockBegin(n, b + 1, num_blocks);
+      for (uint32_t i = LinearQuadTree_blockBegin(n, b, num_blocks); i < end;
+           i++) {
+        counts[b][(src[i].key >> shift) & (LQT_RADIX_BUCKETS - 1)]++;
+      }
+    }
+
+    // Offsets ordered by digit, then block, to keep the sort stable.
+    uint32_t offset = 0;
+    for (uint32_t d = 0; d < LQT_RADIX_BUCKETS; d++) {
+      for (uint32_t b = 0; b < num_blocks; b++) {
+        const uint32_t count = counts[b][d];
+        counts[b][d] = offset;
+        offset += count;
+      }
+    }
+
+    cilk_for (uint32_t b = 0; b < num_blocks; b++) {
+      const uint32_t end = LinearQuadTree_blockBegin(n, b + 1, num_blocks);
+      for (uint32_t i = LinearQuadTree_blockBegin(n, b, num_blocks); i < end;
+           i++) {
+        dst[counts[b][(src[i].key >> shift) & (LQT_RADIX_BUCKETS - 1)]++] =
+            src[i];
+      }
+    }
+
+    LQTEntry* tmp = src;
+    src = dst;
+    dst = tmp;
+  }
+
+  // Keep whichever buffer holds the sorted entries.
+  lqt->entries = src;
+  lqt->scratch = dst;
+  free(counts);
+}
+
+void LinearQuadTree_build(LinearQuadTree* lqt, double xmin, double ymin,
+                          double xmax, double ymax, const LineGeom* geom,
+                          uint32_t num_lines) {
+  if (num_lines > lqt->capacity) {
+    free(lqt->entries);
+    free(lqt->ids);
+    free(lqt->scratch);
+    lqt->entries = malloc(num_lines * sizeof(LQTEntry));
+    lqt->ids = malloc(num_lines * sizeof(uint32_t));
+    lqt->scratch = malloc(num_lines * sizeof(LQTEntry));
+    assert(lqt->entries != NULL && lqt->ids != NULL && lqt->scratch != NULL);
+    lqt->capacity = num_lines;
+  }
+  lqt->num_lines = num_lines;
+  lqt->xmin = xmin;
+  lqt->ymin = ymin;
+  lqt->x_scale = (1u << LQT_MAX_LEVEL) / (xmax - xmin);
+  lqt->y_scale = (1u << LQT_MAX_LEVEL) / (ymax - ymin);
+
+  cilk_for (uint32_t i = 0; i < num_lines; i++) {
+    lqt->entries[i] = (LQTEntry){
+        .key = LinearQuadTree_key(lqt, &geom[i]),
+        .id = i,
+    };
+  }
+  LinearQuadTree_sort(lqt);
+  cilk_for (uint32_t i = 0; i < num_lines; i++) {
+    lqt->ids[i] = lqt->entries[i].id;
+  }
+}
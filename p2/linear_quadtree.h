@@ -0,0 +1,92 @@
+#ifndef LINEAR_QUADTREE_H_
+#define LINEAR_QUADTREE_H_
+
+#include <stdint.h>
+
+#include "linepg.h"
+
+// Cells of the deepest level are 2^-LQT_MAX_LEVEL of the box on a side, so
+// that the Morton code of any cell fits in 32 bits.
+#define LQT_MAX_LEVEL 16
+
+// The level of a cell is stored in the low bits of LQTEntry.key.
+#define LQT_LEVEL_BITS 5
+
+// A line's place in the linear quadtree: the smallest cell that contains its
+// swept box.
+struct LQTEntry {
+  // Morton code of the cell's first deepest-level cell, followed by the
+  // cell's level, so that sorting by key lists every cell before the cells
+  // inside it.
+  uint64_t key;
+  uint32_t id;
+};
+typedef struct LQTEntry LQTEntry;
+
+// A linear quadtree, rebuilt every frame. Instead of nodes, each line gets the
+// Morton code and level of the smallest quadtree cell containing its swept
+// box, and the lines are sorted by code then level. The lines in the subtree
+// of a cell then directly follow the cell's own lines, and finding them is a
+// range scan. Boxes that stick out of the box are clamped to the border
+// cells.
+struct LinearQuadTree {
+  double xmin;
+  double ymin;
+  // Number of deepest-level cells per box unit on each axis.
+  double x_scale;
+  double y_scale;
+
+  // The lines sorted by key, and their IDs in the same order.
+  LQTEntry* entries;
+  uint32_t* ids;
+  uint32_t num_lines;
+  uint32_t capacity;
+  // Scratch space for the radix sort.
+  LQTEntry* scratch;
+};
+typedef struct LinearQuadTree LinearQuadTree;
+
+LinearQuadTree* LinearQuadTree_new();
+void LinearQuadTree_delete(LinearQuadTree* lqt);
+
+// Rebuilds lqt over the box [xmin, xmax] x [ymin, ymax] from the swept boxes
+// in geom, where geom[i] is the geometry of line i. Keys are computed and
+// radix sorted in parallel.
+void LinearQuadTree_build(LinearQuadTree* lqt, double xmin, double ymin,
+                          double xmax, double ymax, const LineGeom* geom,
+                          uint32_t num_lines);
+
+// Returns one past the last entry in the subtree of the cell of entry i, so
+// that entries (i, end) are the lines after i in its own cell and the lines
+// in cells inside it.
+static inline uint32_t LinearQuadTree_subtreeEnd(const LinearQuadTree* lqt,
+                                                 uint32_t i) {
+  const uint64_t key = lqt->entries[i].key;
+  const uint32_t level = key & ((1u << LQT_LEVEL_BITS) - 1);
+  // First key past the cell: its Morton code plus the number of
+  // deepest-level cells it covers.
+  const uint64_t limit =
+      ((key >> LQT_LEVEL_BITS) + (UINT64_C(1) << (2 * (LQT_MAX_LEVEL - level))))
+      << LQT_LEVEL_BITS;
+  uint32_t lo = i + 1;
+  uint32_t hi = lqt->num_lines;
+  while (lo < hi) {
+    const uint32_t mid = lo + (hi - lo) / 2;
+    if (lqt->entries[mid].key < limit) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Writes to ids the lines that follow entry i in its own cell and the lines
+// in cells inside it that overlap the swept box of entry i, and returns their
+// number. Child cells the box misses are skipped, so that lines sitting on
+// the edges of large cells don't scan those cells' whole subtrees. ids must
+// have room for LinearQuadTree_subtreeEnd(lqt, i) - i - 1 IDs.
+uint32_t LinearQuadTree_candidates(const LinearQuadTree* lqt, uint32_t i,
+                                   const LineGeom* geom, uint32_t* ids);
+
+#endif  // LINEAR_QUADTREE_H_
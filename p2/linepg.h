@@ -1,7 +1,10 @@
 #ifndef LINEPG_H_
 #define LINEPG_H_
 
+#include <stdint.h>
+
 #include "line.h"
+#include "vec.h"
 
 // Parallelogram formed by line at current time and line at the next time step
 struct LinePg {
@@ -9,29 +12,29 @@ struct LinePg {
   // CollisionWorld.
   Line next;
   Line* now;
+  // Index of the QuadTree node this pg is stored in.
+  uint32_t node;
 };
 typedef struct LinePg LinePg;
 
-struct LinePgListNode {
-  // The list owns the pg
-  LinePg* pg;
-  struct LinePgListNode* next;
-};
-typedef struct LinePgListNode LinePgListNode;
-
-const LinePgListNode* LinePgListNode_contains(const LinePgListNode* const list,
-                                              const LinePg* const pg);
-void LinePgListNode_free(LinePgListNode* list);
-
-struct LinePgList {
-  LinePgListNode* head;
-  LinePgListNode* tail;
+// Geometry of a line that stays fixed over one frame.
+struct LineGeom {
+  Line* line;
+  // Bounding box of the area the line sweeps between now and the next time
+  // step, padded by LINE_GEOM_SLOP.
+  double xmin;
+  double ymin;
+  double xmax;
+  double ymax;
+  // Vec_makeFromLine of the line and its length, which is also the line's
+  // mass in the collision solver.
+  Vec dir;
+  double length;
 };
-typedef struct LinePgList LinePgList;
+typedef struct LineGeom LineGeom;
 
-void LinePgList_append(LinePgList* list, LinePg* pg);
-void LinePgList_droplast(LinePgList* list, size_t n);
-bool LinePgList_contains(const LinePgList* const list, const LinePg* const pg);
-void LinePgList_free(LinePgList* list);
+// Padding of swept boxes, so that rounding can never make the box test
+// reject a pair that intersect would accept.
+#define LINE_GEOM_SLOP 1e-9
 
 #endif
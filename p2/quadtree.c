@@ -1,10 +1,25 @@
 #include "quadtree.h"
 
 #include <assert.h>
+#include <cilk/cilk.h>
+#include <math.h>
 #include <stdlib.h>
 
 #include "vec.h"
 
+// Builds partition the pgs of a node in blocks of this many, in parallel.
+// Updates flag the pgs to relocate in blocks of the same size.
+#define QT_BUILD_BLOCK 4096
+
+// Smallest region of slots a node reserves once it stores a pg.
+#define QT_MIN_REGION 4
+
+// Quadrant a pg goes to when a node is built: pgs that fit none of the
+// children stay in the node, the others go to child QT_CHILD(k).
+#define QT_STAYS 0
+#define QT_CHILD(k) ((k) + 1)
+#define QT_QUADRANTS 5
+
 static inline bool AABB_contains_point(const AABB* const aabb, const Vec v) {
   const vec_dimension left = aabb->center.x - aabb->half_dim.x;
   const vec_dimension right = aabb->center.x + aabb->half_dim.x;
@@ -28,152 +43,688 @@ bool AABB_contains(const AABB* const aabb, const LinePg* const pg) {
   return nowin1 && nowin2 && nextin1 && nextin2;
 }
 
-QuadTree* QuadTree_init(AABB boundary) {
+QuadTree* QuadTree_new() {
   QuadTree* qt = malloc(sizeof(QuadTree));
   *qt = (QuadTree){
-      .boundary = boundary,
-      .contained = {.head = NULL, .tail = NULL},
-      .contained_sz = 0,
-      .nw = NULL,
-      .ne = NULL,
-      .sw = NULL,
-      .se = NULL,
+      .params = QuadTreeParams_default(),
+      .min_half_dim = Vec_make(0, 0),
+      .nodes = NULL,
+      .num_nodes = 0,
+      .nodes_capacity = 0,
+      .free_blocks = NULL,
+      .num_free_blocks = 0,
+      .items = NULL,
+      .slot_of = NULL,
+      .num_pgs = 0,
+      .pgs_capacity = 0,
+      .slots = NULL,
+      .num_slots = 0,
+      .slots_capacity = 0,
+      .garbage_slots = 0,
+      .moved = NULL,
+      .order = NULL,
+      .scratch = NULL,
+      .quadrant = NULL,
   };
   return qt;
 }
 
-void QuadTree_free(QuadTree* qt) {
+void QuadTree_delete(QuadTree* qt) {
   if (qt == NULL) return;
+  free(qt->nodes);
+  free(qt->free_blocks);
+  free(qt->items);
+  free(qt->slot_of);
+  free(qt->slots);
+  free(qt->moved);
+  free(qt->order);
+  free(qt->scratch);
+  free(qt->quadrant);
+  free(qt);
+}
+
+void QuadTree_setParams(QuadTree* qt, QuadTreeParams params) {
+  assert(params.capacity > 0);
+  qt->params = params;
+  // Forget the tree so that the next update builds it with the new shape.
+  free(qt->nodes);
+  free(qt->free_blocks);
+  qt->nodes = NULL;
+  qt->free_blocks = NULL;
+}
+
+static inline void QuadTreeNode_init(QuadTreeNode* n, AABB boundary,
+                                     uint32_t parent) {
+  *n = (QuadTreeNode){
+      .boundary = boundary,
+      .first = 0,
+      .count = 0,
+      .capacity = 0,
+      .total = 0,
+      .children = 0,
+      .parent = parent,
+  };
+}
+
+// Returns the index of a block of four unused nodes. Invalidates pointers into
+// qt->nodes.
+static uint32_t QuadTree_newblock(QuadTree* const qt) {
+  if (qt->num_free_blocks > 0) {
+    return qt->free_blocks[--qt->num_free_blocks];
+  }
+  if (qt->num_nodes + 4 > qt->nodes_capacity) {
+    qt->nodes_capacity = 2 * qt->nodes_capacity;
+    qt->nodes = realloc(qt->nodes, qt->nodes_capacity * sizeof(QuadTreeNode));
+    // Every block can end up on the free list at once.
+    qt->free_blocks =
+        realloc(qt->free_blocks, qt->nodes_capacity / 4 * sizeof(uint32_t));
+    assert(qt->nodes != NULL && qt->free_blocks != NULL);
+  }
+  const uint32_t block = qt->num_nodes;
+  qt->num_nodes += 4;
+  return block;
+}
 
-  if (qt->contained.head != NULL) {
-    assert(qt->contained.tail != NULL);
-    LinePgListNode_free(qt->contained.head);
-  } else {
-    assert(qt->contained.tail == NULL);
+// Returns the boundary of child k of a node with the given boundary; the
+// children are in nw, ne, sw, se order.
+static inline AABB AABB_quadrant(const AABB boundary, uint32_t k) {
+  const Vec new_half = Vec_multiply(boundary.half_dim, 0.5);
+  const Vec offset = {
+      .x = (k & 1) ? new_half.x : -new_half.x,
+      .y = (k & 2) ? -new_half.y : new_half.y,
+  };
+  return (AABB){
+      .center = Vec_add(boundary.center, offset),
+      .half_dim = new_half,
+  };
+}
+
+static void QuadTree_subdivide(QuadTree* const qt, uint32_t node) {
+  assert(QuadTree_isleaf(qt, node));
+
+  const uint32_t children = QuadTree_newblock(qt);
+  const AABB boundary = qt->nodes[node].boundary;
+  // The four children are consecutive in nw, ne, sw, se order.
+  for (uint32_t k = 0; k < 4; k++) {
+    QuadTreeNode_init(&qt->nodes[children + k], AABB_quadrant(boundary, k),
+                      node);
   }
+  qt->nodes[node].children = children;
+}
 
-  QuadTree_free(qt->nw);
-  QuadTree_free(qt->ne);
-  QuadTree_free(qt->sw);
-  QuadTree_free(qt->se);
+// Moves the regions of all live nodes back to back to the start of a new
+// slots array, dropping the garbage between them.
+static void QuadTree_compact(QuadTree* const qt) {
+  uint32_t* slots = malloc(qt->slots_capacity * sizeof(uint32_t));
+  assert(slots != NULL);
+  uint32_t offset = 0;
+  for (uint32_t node = 0; node < qt->num_nodes; node++) {
+    QuadTreeNode* n = &qt->nodes[node];
+    if (n->children == QT_FREE) {
+      continue;
+    }
+    for (uint32_t i = 0; i < n->count; i++) {
+      const uint32_t item = qt->slots[n->first + i];
+      slots[offset + i] = item;
+      qt->slot_of[item] = offset + i;
+    }
+    n->first = offset;
+    n->capacity = n->count;
+    offset += n->count;
+  }
+  free(qt->slots);
+  qt->slots = slots;
+  qt->num_slots = offset;
+  qt->garbage_slots = 0;
+}
 
-  free(qt);
+// Makes room for sz more slots after the used ones, compacting when at least
+// half of the slots are garbage and growing the array otherwise. May move
+// every node's region.
+static void QuadTree_reserveSlots(QuadTree* const qt, uint32_t sz) {
+  if (qt->num_slots + sz <= qt->slots_capacity) {
+    return;
+  }
+  if (qt->garbage_slots >= qt->num_slots / 2) {
+    QuadTree_compact(qt);
+  }
+  if (qt->num_slots + sz > qt->slots_capacity) {
+    qt->slots_capacity = 2 * qt->slots_capacity > qt->num_slots + sz
+                             ? 2 * qt->slots_capacity
+                             : qt->num_slots + sz;
+    qt->slots = realloc(qt->slots, qt->slots_capacity * sizeof(uint32_t));
+    assert(qt->slots != NULL);
+  }
 }
 
-bool QuadTree_isleaf(const QuadTree* const qt) {
-  if (qt == NULL) return false;
-  if (qt->nw == NULL) {
-    assert(qt->ne == NULL);
-    assert(qt->sw == NULL);
-    assert(qt->se == NULL);
-    return true;
+// Stores item in node's own slots, doubling the node's region if it is full.
+static void QuadTree_append(QuadTree* const qt, uint32_t node, uint32_t item) {
+  QuadTreeNode* n = &qt->nodes[node];
+  if (n->count == n->capacity) {
+    const uint32_t capacity =
+        n->capacity < QT_MIN_REGION ? QT_MIN_REGION : 2 * n->capacity;
+    // Reserving may compact the regions, so it comes first.
+    QuadTree_reserveSlots(qt, capacity);
+    if (n->first + n->capacity == qt->num_slots) {
+      // The region is the last one, so it can grow in place.
+      qt->num_slots += capacity - n->capacity;
+    } else {
+      const uint32_t first = qt->num_slots;
+      for (uint32_t i = 0; i < n->count; i++) {
+        const uint32_t moved = qt->slots[n->first + i];
+        qt->slots[first + i] = moved;
+        qt->slot_of[moved] = first + i;
+      }
+      qt->garbage_slots += n->capacity;
+      n->first = first;
+      qt->num_slots += capacity;
+    }
+    n->capacity = capacity;
+  }
+  const uint32_t slot = n->first + n->count++;
+  qt->slots[slot] = item;
+  qt->slot_of[item] = slot;
+  qt->items[item].node = node;
+}
+
+// Takes item out of its node's own slots. Subtree totals are left alone.
+static void QuadTree_removeSlot(QuadTree* const qt, uint32_t item) {
+  QuadTreeNode* n = &qt->nodes[qt->items[item].node];
+  const uint32_t slot = qt->slot_of[item];
+  const uint32_t last = qt->slots[n->first + --n->count];
+  qt->slots[slot] = last;
+  qt->slot_of[last] = slot;
+}
+
+// Adds delta to the subtree totals of node and all its ancestors.
+static void QuadTree_addTotal(QuadTree* const qt, uint32_t node,
+                              int32_t delta) {
+  for (;;) {
+    qt->nodes[node].total += delta;
+    if (node == QT_ROOT) {
+      return;
+    }
+    node = qt->nodes[node].parent;
+  }
+}
+
+// Returns the child of node that contains pg, or QT_FREE if none does or
+// node is a leaf.
+static inline uint32_t QuadTree_childFor(const QuadTree* const qt,
+                                         uint32_t node,
+                                         const LinePg* const pg) {
+  const uint32_t children = qt->nodes[node].children;
+  if (children == 0) {
+    return QT_FREE;
+  }
+  for (uint32_t child = children; child < children + 4; child++) {
+    if (AABB_contains(&qt->nodes[child].boundary, pg)) {
+      return child;
+    }
+  }
+  return QT_FREE;
+}
+
+static void QuadTree_split(QuadTree* const qt, uint32_t node);
+
+// Stores item as deep in node's subtree as it fits, counting it in the totals
+// of node and the nodes below it on the way. item's pg must be inside node's
+// boundary, unless node is the root.
+static void QuadTree_insert(QuadTree* const qt, uint32_t node, uint32_t item) {
+  const LinePg* const pg = &qt->items[item];
+  for (;;) {
+    qt->nodes[node].total++;
+    if (QuadTree_isleaf(qt, node)) {
+      const Vec half_dim = qt->nodes[node].boundary.half_dim;
+      if (qt->nodes[node].count < qt->params.capacity ||
+          0.5 * half_dim.x < qt->min_half_dim.x ||
+          0.5 * half_dim.y < qt->min_half_dim.y) {
+        // Store locally if we're below the soft limit on items stored in this
+        // node, or if its children would be too deep or too small.
+        QuadTree_append(qt, node, item);
+        return;
+      }
+      // Otherwise, create children for this node to add into.
+      QuadTree_split(qt, node);
+    }
+    const uint32_t child = QuadTree_childFor(qt, node, pg);
+    if (child == QT_FREE) {
+      // If it fits none of the children, we just store here.
+      QuadTree_append(qt, node, item);
+      return;
+    }
+    node = child;
+  }
+}
+
+// Subdivides the leaf node and pushes the pgs it holds down into the children
+// that contain them.
+static void QuadTree_split(QuadTree* const qt, uint32_t node) {
+  QuadTree_subdivide(qt, node);
+  // Going backwards, the slot removing an item fills has already been seen.
+  for (uint32_t i = qt->nodes[node].count; i-- > 0;) {
+    const uint32_t item = qt->slots[qt->nodes[node].first + i];
+    const uint32_t child = QuadTree_childFor(qt, node, &qt->items[item]);
+    if (child != QT_FREE) {
+      QuadTree_removeSlot(qt, item);
+      QuadTree_insert(qt, child, item);
+    }
   }
-  return false;
 }
 
-static bool QuadTree_haslocal(const QuadTree* const qt) {
-  if (qt == NULL) return false;
-  if (qt->contained_sz == 0) {
-    assert(qt->contained.head == NULL);
-    assert(qt->contained.tail == NULL);
-    return false;
-  } else {
-    assert(qt->contained.head != NULL);
-    assert(qt->contained.tail != NULL);
+// Returns true if item's pg left its node or fits one of the node's
+// children, so that QuadTree_relocate would move it.
+static inline bool QuadTree_misplaced(const QuadTree* const qt,
+                                      const LinePg* const pg) {
+  const uint32_t node = pg->node;
+  if (node != QT_ROOT && !AABB_contains(&qt->nodes[node].boundary, pg)) {
     return true;
   }
+  return QuadTree_childFor(qt, node, pg) != QT_FREE;
 }
 
-static void QuadTree_subdivide(QuadTree* const qt) {
-  assert(QuadTree_isleaf(qt));
+// Moves item, whose line has moved since it was stored, to a node that
+// contains it. item stays put if it still fits its node and none of the
+// node's children.
+static void QuadTree_relocate(QuadTree* const qt, uint32_t item) {
+  const LinePg* const pg = &qt->items[item];
+  uint32_t node = pg->node;
 
-  AABB boundary = qt->boundary;
-  Vec new_half = Vec_multiply(boundary.half_dim, 0.5);
+  if (node != QT_ROOT && !AABB_contains(&qt->nodes[node].boundary, pg)) {
+    QuadTree_removeSlot(qt, item);
+    QuadTree_addTotal(qt, node, -1);
+    // Climb to the closest ancestor that still contains pg...
+    do {
+      node = qt->nodes[node].parent;
+    } while (node != QT_ROOT && !AABB_contains(&qt->nodes[node].boundary, pg));
+    // ...and settle it as deep as it goes from there. Pgs that stick out of
+    // the whole tree are stored in the root.
+    if (node != QT_ROOT) {
+      QuadTree_addTotal(qt, qt->nodes[node].parent, 1);
+      QuadTree_insert(qt, node, item);
+    } else if (AABB_contains(&qt->nodes[QT_ROOT].boundary, pg)) {
+      QuadTree_insert(qt, QT_ROOT, item);
+    } else {
+      qt->nodes[QT_ROOT].total++;
+      QuadTree_append(qt, QT_ROOT, item);
+    }
+    return;
+  }
 
-  AABB nw_boundary = {
-      .center =
-          Vec_add(boundary.center, (Vec){.x = -new_half.x, .y = new_half.y}),
-      .half_dim = new_half,
-  };
-  qt->nw = QuadTree_init(nw_boundary);
+  // pg may have stopped straddling the children of an inner node.
+  const uint32_t child = QuadTree_childFor(qt, node, pg);
+  if (child != QT_FREE) {
+    QuadTree_removeSlot(qt, item);
+    QuadTree_insert(qt, child, item);
+  }
+}
 
-  AABB ne_boundary = {
-      .center =
-          Vec_add(boundary.center, (Vec){.x = new_half.x, .y = new_half.y}),
-      .half_dim = new_half,
-  };
-  qt->ne = QuadTree_init(ne_boundary);
+// Moves the pgs of the subtree below node into node itself and frees the
+// subtree's nodes.
+static void QuadTree_gather(QuadTree* const qt, uint32_t node, uint32_t from) {
+  const uint32_t children = qt->nodes[from].children;
+  if (children == 0) {
+    return;
+  }
+  for (uint32_t child = children; child < children + 4; child++) {
+    QuadTree_gather(qt, node, child);
+    // Appending may move the child's region, so it is looked up every time.
+    while (qt->nodes[child].count > 0) {
+      const QuadTreeNode* c = &qt->nodes[child];
+      const uint32_t item = qt->slots[c->first + c->count - 1];
+      qt->nodes[child].count--;
+      QuadTree_append(qt, node, item);
+    }
+    qt->garbage_slots += qt->nodes[child].capacity;
+    qt->nodes[child].capacity = 0;
+    qt->nodes[child].children = QT_FREE;
+  }
+  qt->free_blocks[qt->num_free_blocks++] = children;
+}
 
-  AABB sw_boundary = {
-      .center =
-          Vec_add(boundary.center, (Vec){.x = -new_half.x, .y = -new_half.y}),
-      .half_dim = new_half,
-  };
-  qt->sw = QuadTree_init(sw_boundary);
+// Collapses the highest subtree on the path from node to the root that holds
+// few enough pgs to fit in a leaf, if any. Called for the nodes that lost
+// pgs, since only their ancestors' totals went down.
+static void QuadTree_merge(QuadTree* const qt, uint32_t node) {
+  if (qt->nodes[node].children == QT_FREE) {
+    // Already merged into an ancestor.
+    return;
+  }
+  uint32_t merge = QT_FREE;
+  for (;;) {
+    if (!QuadTree_isleaf(qt, node) &&
+        qt->nodes[node].total <= qt->params.capacity) {
+      merge = node;
+    }
+    if (node == QT_ROOT) {
+      break;
+    }
+    node = qt->nodes[node].parent;
+  }
+  if (merge != QT_FREE) {
+    QuadTree_gather(qt, merge, merge);
+    qt->nodes[merge].children = 0;
+  }
+}
 
-  AABB se_boundary = {
-      .center =
-          Vec_add(boundary.center, (Vec){.x = new_half.x, .y = -new_half.y}),
-      .half_dim = new_half,
-  };
-  qt->se = QuadTree_init(se_boundary);
+// Starts over with just a root covering boundary.
+static void QuadTree_reset(QuadTree* const qt, AABB boundary,
+                           uint32_t num_pgs) {
+  if (qt->nodes == NULL) {
+    qt->nodes_capacity = 64;
+    qt->nodes = malloc(qt->nodes_capacity * sizeof(QuadTreeNode));
+    qt->free_blocks = malloc(qt->nodes_capacity / 4 * sizeof(uint32_t));
+    assert(qt->nodes != NULL && qt->free_blocks != NULL);
+  }
+  if (num_pgs > qt->pgs_capacity) {
+    free(qt->items);
+    free(qt->slot_of);
+    free(qt->slots);
+    free(qt->moved);
+    free(qt->order);
+    free(qt->scratch);
+    free(qt->quadrant);
+    qt->items = malloc(num_pgs * sizeof(LinePg));
+    qt->slot_of = malloc(num_pgs * sizeof(uint32_t));
+    qt->slots = malloc(num_pgs * sizeof(uint32_t));
+    qt->moved = malloc(num_pgs * sizeof(uint32_t));
+    qt->order = malloc(num_pgs * sizeof(QuadTreeBuildItem));
+    qt->scratch = malloc(num_pgs * sizeof(QuadTreeBuildItem));
+    qt->quadrant = malloc(num_pgs * sizeof(uint8_t));
+    assert(qt->items != NULL && qt->slot_of != NULL && qt->slots != NULL &&
+           qt->moved != NULL && qt->order != NULL && qt->scratch != NULL &&
+           qt->quadrant != NULL);
+    qt->pgs_capacity = num_pgs;
+    qt->slots_capacity = num_pgs;
+  }
+  qt->num_slots = 0;
+  qt->garbage_slots = 0;
+  // Halving is exact, so a node at depth max_depth has exactly this size.
+  const double scale = ldexp(1.0, -(int)qt->params.max_depth);
+  qt->min_half_dim = Vec_make(
+      fmax(boundary.half_dim.x * scale, 0.5 * qt->params.min_cell),
+      fmax(boundary.half_dim.y * scale, 0.5 * qt->params.min_cell));
+  // The root takes up a whole block so that child blocks stay 4-aligned.
+  qt->num_nodes = 4;
+  qt->num_free_blocks = 0;
+  QuadTreeNode_init(&qt->nodes[QT_ROOT], boundary, QT_ROOT);
+  for (uint32_t i = 1; i < 4; i++) {
+    qt->nodes[i].children = QT_FREE;
+  }
+}
+
+// Node of the tree QuadTree_build makes before copying it into qt->nodes,
+// which can't grow while several workers are adding nodes.
+struct QuadTreeBuildNode {
+  // The node's own pgs.
+  const QuadTreeBuildItem* own;
+  uint32_t count;
+  // Four children in nw, ne, sw, se order, or NULL for leaves.
+  struct QuadTreeBuildNode* children;
+};
+typedef struct QuadTreeBuildNode QuadTreeBuildNode;
 
-  // TODO: attempt to insert contained nodes into children instead?
+// Edges of the children of a node, computed the way AABB_contains computes
+// them, so that a pg's box lies strictly inside exactly when AABB_contains
+// holds.
+struct QuadTreeEdges {
+  vec_dimension left[4];
+  vec_dimension right[4];
+  vec_dimension bottom[4];
+  vec_dimension top[4];
+};
+typedef struct QuadTreeEdges QuadTreeEdges;
+
+static inline QuadTreeEdges QuadTreeEdges_make(const AABB boundary) {
+  QuadTreeEdges edges;
+  for (uint32_t k = 0; k < 4; k++) {
+    const AABB child = AABB_quadrant(boundary, k);
+    edges.left[k] = child.center.x - child.half_dim.x;
+    edges.right[k] = child.center.x + child.half_dim.x;
+    edges.bottom[k] = child.center.y - child.half_dim.y;
+    edges.top[k] = child.center.y + child.half_dim.y;
+  }
+  return edges;
 }
 
-static void QuadTree_add(QuadTree* const qt, const LinePg* const pg) {
-  LinePgList_append(&qt->contained, pg);
-  qt->contained_sz++;
+// Returns the quadrant the pg with box b goes to.
+static inline uint8_t QuadTree_classify(const QuadTreeEdges* const edges,
+                                        const QuadTreeBuildItem* const b) {
+  for (uint32_t k = 0; k < 4; k++) {
+    if (b->xmin > edges->left[k] && b->xmax < edges->right[k] &&
+        b->ymin > edges->bottom[k] && b->ymax < edges->top[k]) {
+      return QT_CHILD(k);
+    }
+  }
+  return QT_STAYS;
 }
 
-bool QuadTree_insert(QuadTree* const qt, const LinePg* const pg) {
-  // If the pg isn't in the bounds of this qt node, we can't insert it here.
-  if (!AABB_contains(&qt->boundary, pg)) {
-    return false;
+// Stably partitions the count pgs of src by quadrant of boundary into dst, in
+// QT_STAYS, nw, ne, sw, se order, and sets sizes to the size of each
+// quadrant. quadrant is scratch space for count entries. Blocks of pgs are
+// classified and scattered in parallel.
+static void QuadTree_partition(const AABB boundary,
+                               const QuadTreeBuildItem* src,
+                               QuadTreeBuildItem* dst, uint8_t* quadrant,
+                               uint32_t count, uint32_t sizes[QT_QUADRANTS]) {
+  const QuadTreeEdges edges = QuadTreeEdges_make(boundary);
+
+  // Size of each quadrant in each block, then where the block's pgs of that
+  // quadrant go in dst.
+  const uint32_t num_blocks = (count + QT_BUILD_BLOCK - 1) / QT_BUILD_BLOCK;
+  uint32_t one_block[1][QT_QUADRANTS];
+  uint32_t(*offsets)[QT_QUADRANTS] =
+      num_blocks == 1 ? one_block
+                      : malloc(num_blocks * sizeof(uint32_t[QT_QUADRANTS]));
+  cilk_for (uint32_t b = 0; b < num_blocks; b++) {
+    const uint32_t end = b + 1 < num_blocks ? (b + 1) * QT_BUILD_BLOCK : count;
+    for (uint32_t q = 0; q < QT_QUADRANTS; q++) {
+      offsets[b][q] = 0;
+    }
+    for (uint32_t i = b * QT_BUILD_BLOCK; i < end; i++) {
+      quadrant[i] = QuadTree_classify(&edges, &src[i]);
+      offsets[b][quadrant[i]]++;
+    }
   }
 
-  if (QuadTree_isleaf(qt)) {
-    if (qt->contained_sz < QT_SOFT_CAPACITY) {
-      // Store locally if we're below the soft limit on items stored in this
-      // node.
-      QuadTree_add(qt, pg);
-      return true;
-    } else {
-      // Otherwise, create children for this node to add into.
-      QuadTree_subdivide(qt);
+  uint32_t offset = 0;
+  for (uint32_t q = 0; q < QT_QUADRANTS; q++) {
+    sizes[q] = 0;
+    for (uint32_t b = 0; b < num_blocks; b++) {
+      const uint32_t size = offsets[b][q];
+      offsets[b][q] = offset;
+      offset += size;
+      sizes[q] += size;
+    }
+  }
+
+  cilk_for (uint32_t b = 0; b < num_blocks; b++) {
+    const uint32_t end = b + 1 < num_blocks ? (b + 1) * QT_BUILD_BLOCK : count;
+    for (uint32_t i = b * QT_BUILD_BLOCK; i < end; i++) {
+      dst[offsets[b][quadrant[i]]++] = src[i];
     }
   }
 
-  // Try to insert into one of the child nodes
-  if (QuadTree_insert(qt->nw, pg)) return true;
-  if (QuadTree_insert(qt->ne, pg)) return true;
-  if (QuadTree_insert(qt->sw, pg)) return true;
-  if (QuadTree_insert(qt->se, pg)) return true;
+  if (offsets != one_block) {
+    free(offsets);
+  }
+}
+
+// Builds the subtree of a node with the given boundary out of the count pgs
+// of src, using dst and quadrant as scratch. A node is split when it has more
+// pgs than a leaf may hold and its children would not be too small; pgs that
+// fit no child stay in it and the rest are built into the children in
+// parallel.
+static void QuadTree_buildNode(const QuadTree* const qt,
+                               QuadTreeBuildNode* const bn, const AABB boundary,
+                               QuadTreeBuildItem* src, QuadTreeBuildItem* dst,
+                               uint8_t* quadrant, uint32_t count) {
+  *bn = (QuadTreeBuildNode){.own = src, .count = count, .children = NULL};
+  if (count <= qt->params.capacity ||
+      0.5 * boundary.half_dim.x < qt->min_half_dim.x ||
+      0.5 * boundary.half_dim.y < qt->min_half_dim.y) {
+    return;
+  }
+
+  uint32_t sizes[QT_QUADRANTS];
+  QuadTree_partition(boundary, src, dst, quadrant, count, sizes);
+  if (sizes[QT_STAYS] == count) {
+    // Nothing fits a child, so there is no point in having children.
+    return;
+  }
+
+  bn->own = dst;
+  bn->count = sizes[QT_STAYS];
+  bn->children = malloc(4 * sizeof(QuadTreeBuildNode));
+  assert(bn->children != NULL);
+  // Each child's pgs are in dst, and it partitions them back into src.
+  uint32_t first = sizes[QT_STAYS];
+  for (uint32_t k = 0; k < 4; k++) {
+    const uint32_t size = sizes[QT_CHILD(k)];
+    cilk_spawn QuadTree_buildNode(qt, &bn->children[k],
+                                  AABB_quadrant(boundary, k), dst + first,
+                                  src + first, quadrant + first, size);
+    first += size;
+  }
+  cilk_sync;
+}
+
+// Copies the subtree of bn into node, which is a leaf, laying the pgs of its
+// nodes out back to back in slots, and frees it. Returns the number of pgs in
+// the subtree.
+static uint32_t QuadTree_flatten(QuadTree* const qt,
+                                 QuadTreeBuildNode* const bn, uint32_t node) {
+  QuadTreeNode* n = &qt->nodes[node];
+  n->first = qt->num_slots;
+  n->count = bn->count;
+  n->capacity = bn->count;
+  qt->num_slots += bn->count;
+  for (uint32_t i = 0; i < bn->count; i++) {
+    const uint32_t item = bn->own[i].item;
+    qt->items[item].node = node;
+    qt->slots[n->first + i] = item;
+    qt->slot_of[item] = n->first + i;
+  }
+  uint32_t total = bn->count;
+  if (bn->children != NULL) {
+    QuadTree_subdivide(qt, node);
+    const uint32_t children = qt->nodes[node].children;
+    for (uint32_t k = 0; k < 4; k++) {
+      total += QuadTree_flatten(qt, &bn->children[k], children + k);
+    }
+    free(bn->children);
+  }
+  qt->nodes[node].total = total;
+  return total;
+}
+
+// Builds the tree of pgs from the root QuadTree_reset left.
+static void QuadTree_build(QuadTree* const qt, const LinePg* pgs,
+                           uint32_t num_pgs) {
+  cilk_for (uint32_t i = 0; i < num_pgs; i++) {
+    const Line* now = pgs[i].now;
+    const Line* next = &pgs[i].next;
+    qt->items[i] = pgs[i];
+    qt->order[i] = (QuadTreeBuildItem){
+        .xmin = fmin(fmin(now->p1.x, now->p2.x), fmin(next->p1.x, next->p2.x)),
+        .ymin = fmin(fmin(now->p1.y, now->p2.y), fmin(next->p1.y, next->p2.y)),
+        .xmax = fmax(fmax(now->p1.x, now->p2.x), fmax(next->p1.x, next->p2.x)),
+        .ymax = fmax(fmax(now->p1.y, now->p2.y), fmax(next->p1.y, next->p2.y)),
+        .item = i,
+    };
+  }
+  QuadTreeBuildNode root;
+  QuadTree_buildNode(qt, &root, qt->nodes[QT_ROOT].boundary, qt->order,
+                     qt->scratch, qt->quadrant, num_pgs);
+  QuadTree_flatten(qt, &root, QT_ROOT);
+}
+
+// Writes to moved, in order, the indices of the num_pgs flags that are set,
+// and returns their number. Blocks of flags are counted and scattered in
+// parallel.
+static uint32_t QuadTree_pack(const uint8_t* flags, uint32_t num_pgs,
+                              uint32_t* moved) {
+  const uint32_t num_blocks = (num_pgs + QT_BUILD_BLOCK - 1) / QT_BUILD_BLOCK;
+  uint32_t one_block[1];
+  uint32_t* offsets =
+      num_blocks <= 1 ? one_block : malloc(num_blocks * sizeof(uint32_t));
+  cilk_for (uint32_t b = 0; b < num_blocks; b++) {
+    const uint32_t end =
+        b + 1 < num_blocks ? (b + 1) * QT_BUILD_BLOCK : num_pgs;
+    uint32_t count = 0;
+    for (uint32_t i = b * QT_BUILD_BLOCK; i < end; i++) {
+      count += flags[i];
+    }
+    offsets[b] = count;
+  }
+
+  uint32_t offset = 0;
+  for (uint32_t b = 0; b < num_blocks; b++) {
+    const uint32_t count = offsets[b];
+    offsets[b] = offset;
+    offset += count;
+  }
+
+  cilk_for (uint32_t b = 0; b < num_blocks; b++) {
+    const uint32_t end =
+        b + 1 < num_blocks ? (b + 1) * QT_BUILD_BLOCK : num_pgs;
+    uint32_t out = offsets[b];
+    for (uint32_t i = b * QT_BUILD_BLOCK; i < end; i++) {
+      if (flags[i]) {
+        moved[out++] = i;
+      }
+    }
+  }
 
-  // If we couldn't insert into any of the child nodes, we just store here.
-  QuadTree_add(qt, pg);
-  return true;
+  if (offsets != one_block) {
+    free(offsets);
+  }
+  return offset;
 }
 
-// TODO: idea: instead of doing this search, add a link back from a linepg to
-// the quadtree node parent?
-const QuadTree* QuadTree_query(const QuadTree* const qt,
-                               const LinePg* const pg) {
-  if (!AABB_contains(&qt->boundary, pg)) {
-    return NULL;
+void QuadTree_update(QuadTree* qt, AABB boundary, const LinePg* pgs,
+                     uint32_t num_pgs) {
+  if (qt->nodes == NULL || num_pgs != qt->num_pgs) {
+    QuadTree_reset(qt, boundary, num_pgs);
+    qt->num_pgs = num_pgs;
+    QuadTree_build(qt, pgs, num_pgs);
+    return;
+  }
+
+  // Take in the new pgs and flag the ones that must move, in parallel.
+  cilk_for (uint32_t i = 0; i < num_pgs; i++) {
+    const uint32_t node = qt->items[i].node;
+    qt->items[i] = pgs[i];
+    qt->items[i].node = node;
+    qt->quadrant[i] = QuadTree_misplaced(qt, &qt->items[i]);
   }
+  const uint32_t num_moved = QuadTree_pack(qt->quadrant, num_pgs, qt->moved);
 
-  if (!QuadTree_isleaf(qt)) {
-    if (QuadTree_query(qt->nw, pg)) return qt->nw;
-    if (QuadTree_query(qt->ne, pg)) return qt->ne;
-    if (QuadTree_query(qt->sw, pg)) return qt->sw;
-    if (QuadTree_query(qt->se, pg)) return qt->se;
+  // Relocate them, remembering the nodes they left...
+  for (uint32_t i = 0; i < num_moved; i++) {
+    const uint32_t item = qt->moved[i];
+    qt->moved[i] = qt->items[item].node;
+    QuadTree_relocate(qt, item);
   }
+  // ...and merge the subtrees that emptied out above those nodes.
+  for (uint32_t i = 0; i < num_moved; i++) {
+    QuadTree_merge(qt, qt->moved[i]);
+  }
+}
 
-  if (qt->contained_sz > 0 && LinePgList_contains(&qt->contained, pg)) {
-    assert(QuadTree_haslocal(qt));
-    return qt;
+#ifdef INSTRUMENT
+static void QuadTree_instrumentNode(const QuadTree* const qt, uint32_t node,
+                                    uint32_t depth) {
+  Instrument_quadTreeNode(depth, qt->nodes[node].count);
+  if (!QuadTree_isleaf(qt, node)) {
+    const uint32_t children = qt->nodes[node].children;
+    for (uint32_t child = children; child < children + 4; child++) {
+      QuadTree_instrumentNode(qt, child, depth + 1);
+    }
   }
+}
 
-  return NULL;
+void QuadTree_instrument(const QuadTree* qt) {
+  QuadTree_instrumentNode(qt, QT_ROOT, 0);
 }
+#endif
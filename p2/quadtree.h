@@ -2,15 +2,40 @@
 #define QUADTREE_H_
 
 #include <stddef.h>
+#include <stdint.h>
 
+#include "instrument.h"
 #include "line.h"
 #include "linepg.h"
 #include "vec.h"
 
-// We want a quadtree node to start putting things into its children once it has
-// 4 elements, so that we have enough data to be worth using the children. Can
-// look into tuning this value to help performance.
+// Defaults for QuadTreeParams. We want a quadtree node to start putting things
+// into its children once it has 4 elements, so that we have enough data to be
+// worth using the children. The best values depend a lot on the scene; see
+// the screensaver's --autotune.
 #define QT_SOFT_CAPACITY 4
+#define QT_MAX_DEPTH 16
+#define QT_MIN_CELL 0.0
+
+// Shape of a QuadTree.
+struct QuadTreeParams {
+  // Number of pgs a leaf holds before it is split.
+  uint32_t capacity;
+  // Nodes at this depth are never split. The root has depth 0.
+  uint32_t max_depth;
+  // Nodes are never split into children narrower than this, in box units.
+  double min_cell;
+};
+typedef struct QuadTreeParams QuadTreeParams;
+
+// Returns the default QuadTreeParams.
+static inline QuadTreeParams QuadTreeParams_default() {
+  return (QuadTreeParams){
+      .capacity = QT_SOFT_CAPACITY,
+      .max_depth = QT_MAX_DEPTH,
+      .min_cell = QT_MIN_CELL,
+  };
+}
 
 // Axis aligned bounding box
 struct AABB {
@@ -23,25 +48,121 @@ typedef struct AABB AABB;
 // defined by the AABB
 bool AABB_contains(const AABB* const aabb, const LinePg* const pg);
 
-struct QuadTree {
+// Node of a QuadTree. Nodes refer to each other and to their pgs by index so
+// that they can live in flat arrays.
+struct QuadTreeNode {
   AABB boundary;
 
-  LinePgList contained;
-  size_t contained_sz;
+  // The items of the pgs stored in this node are qt->slots[first, first +
+  // count), in a region of capacity slots reserved for the node.
+  uint32_t first;
+  uint32_t count;
+  uint32_t capacity;
+  // Number of pgs stored in the node's subtree, its own included.
+  uint32_t total;
+
+  // Index of the nw child, followed by ne, sw and se. 0 for leaves, since the
+  // root is never anyone's child, and QT_FREE for unused nodes.
+  uint32_t children;
+  uint32_t parent;
+};
+typedef struct QuadTreeNode QuadTreeNode;
+
+// Index of the root node.
+#define QT_ROOT 0
+#define QT_FREE UINT32_MAX
+
+// A pg's bounding box and index, as moved around while the tree is built.
+struct QuadTreeBuildItem {
+  vec_dimension xmin;
+  vec_dimension ymin;
+  vec_dimension xmax;
+  vec_dimension ymax;
+  uint32_t item;
+};
+typedef struct QuadTreeBuildItem QuadTreeBuildItem;
+
+// A quadtree that is kept alive across frames. Every frame it is handed the
+// new pg of each line, finds in parallel the lines whose pg left their node
+// or now fits one of its children, and only relocates those, splitting full
+// leaves as lines arrive and merging the subtrees they left once they have
+// emptied out.
+struct QuadTree {
+  QuadTreeParams params;
+  // Children smaller than this are never created; derived from params and the
+  // root's boundary.
+  Vec min_half_dim;
+
+  // Node pool; nodes[QT_ROOT] is the root. Children are allocated in blocks
+  // of four, and blocks freed by merges are reused.
+  QuadTreeNode* nodes;
+  uint32_t num_nodes;
+  uint32_t nodes_capacity;
+  uint32_t* free_blocks;
+  uint32_t num_free_blocks;
+
+  // The latest pg of each line, in line order. items[i].node is where line i
+  // is stored, and slot_of[i] where in slots.
+  LinePg* items;
+  uint32_t* slot_of;
+  uint32_t num_pgs;
+  uint32_t pgs_capacity;
 
-  struct QuadTree* nw;
-  struct QuadTree* ne;
-  struct QuadTree* sw;
-  struct QuadTree* se;
+  // Item indices grouped by node, so each node's pgs are contiguous. A node
+  // that outgrows its region moves it to the end of the used slots; the
+  // regions left behind are garbage until the next compaction.
+  uint32_t* slots;
+  uint32_t num_slots;
+  uint32_t slots_capacity;
+  uint32_t garbage_slots;
+  // The items to relocate in the current update.
+  uint32_t* moved;
+
+  // Scratch space for building the tree from scratch: two buffers of pgs that
+  // each level is partitioned back and forth between, and the quadrant of
+  // each entry of the buffer being partitioned. Updates flag the items to
+  // relocate in quadrant.
+  QuadTreeBuildItem* order;
+  QuadTreeBuildItem* scratch;
+  uint8_t* quadrant;
 };
 typedef struct QuadTree QuadTree;
 
-QuadTree* QuadTree_init(AABB boundary);
-void QuadTree_free(QuadTree* qt);
-bool QuadTree_isleaf(const QuadTree* const qt);
-bool QuadTree_insert(QuadTree* const qt, const LinePg* const pg);
-const QuadTree* QuadTree_query(const QuadTree* const qt,
-                               const LinePg* const pg);
-bool QuadTree_remove(QuadTree* const qt, const LinePg* const pg);
+QuadTree* QuadTree_new();
+void QuadTree_delete(QuadTree* qt);
+
+// Changes the shape of qt. The tree is rebuilt on the next QuadTree_update.
+void QuadTree_setParams(QuadTree* qt, QuadTreeParams params);
+
+// Brings qt up to date with pgs, where pgs[i] is the new pg of the line that
+// was at index i in the previous call. The node fields of pgs are ignored.
+// The tree is built from scratch on the first call, when num_pgs changes or
+// after QuadTree_setParams. Builds partition all the pgs top down, level by
+// level, in parallel. Other calls only do serial work for the lines that must
+// move and for the ancestors of the nodes they left.
+// Pgs that are not inside boundary (lines that have gone past a wall) are
+// stored in the root.
+void QuadTree_update(QuadTree* qt, AABB boundary, const LinePg* pgs,
+                     uint32_t num_pgs);
+
+#ifdef INSTRUMENT
+// Reports the depth and occupancy of every live node to Instrument.
+void QuadTree_instrument(const QuadTree* qt);
+#endif
+
+static inline const QuadTreeNode* QuadTree_node(const QuadTree* const qt,
+                                                uint32_t node) {
+  return &qt->nodes[node];
+}
+
+static inline bool QuadTree_isleaf(const QuadTree* const qt, uint32_t node) {
+  return qt->nodes[node].children == 0;
+}
+
+// Returns the node pg is stored in.
+static inline const QuadTreeNode* QuadTree_query(const QuadTree* const qt,
+                                                 const LinePg* const pg) {
+  return &qt->nodes[pg->node];
+}
 
 #endif  // QUADTREE_H_
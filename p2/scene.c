@@ -0,0 +1,362 @@
+#include "./scene.h"
+
+#include <cilk/cilk.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./line.h"
+
+// Number of values in a text record.
+#define SCENE_RECORD_VALUES 7
+
+// Powers of ten that are exact doubles.
+static const double scene_powers_of_ten[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static inline bool Scene_isDigit(char c) { return c >= '0' && c <= '9'; }
+
+static inline bool Scene_isNumberStart(char c) {
+  return Scene_isDigit(c) || c == '-' || c == '+' || c == '.';
+}
+
+// Parses the decimal number at *p, which must end before end, into *value and
+// advances *p past it. Returns false if there is no number at *p.
+//
+// Numbers with at most 19 significant digits, a mantissa below 2^53 and a
+// power of ten within 10^+-22 are converted with one multiply or divide of
+// two exact doubles, which rounds correctly and so gives the same result as
+// strtod. Anything else is handed to strtod.
+static bool Scene_parseNumber(const char** p, const char* end,
+                              double* value) {
+  const char* const start = *p;
+  const char* s = start;
+  bool negative = false;
+  if (s < end && (*s == '-' || *s == '+')) {
+    negative = *s == '-';
+    s++;
+  }
+
+  uint64_t mantissa = 0;
+  int digits = 0;
+  int exponent = 0;
+  bool any_digits = false;
+  bool exact = true;
+  for (; s < end && Scene_isDigit(*s); s++) {
+    any_digits = true;
+    if (digits < 19) {
+      mantissa = 10 * mantissa + (*s - '0');
+      digits += mantissa != 0;
+    } else {
+      exact = false;
+    }
+  }
+  if (s < end && *s == '.') {
+    for (s++; s < end && Scene_isDigit(*s); s++) {
+      any_digits = true;
+      if (digits < 19) {
+        mantissa = 10 * mantissa + (*s - '0');
+        digits += mantissa != 0;
+        exponent--;
+      } else {
+        exact = false;
+      }
+    }
+  }
+  if (!any_digits) {
+    return false;
+  }
+  if (s < end && (*s == 'e' || *s == 'E')) {
+    const char* e = s + 1;
+    bool negative_exponent = false;
+    if (e < end && (*e == '-' || *e == '+')) {
+      negative_exponent = *e == '-';
+      e++;
+    }
+    if (e < end && Scene_isDigit(*e)) {
+      int power = 0;
+      for (; e < end && Scene_isDigit(*e); e++) {
+        if (power < 10000) power = 10 * power + (*e - '0');
+      }
+      exponent += negative_exponent ? -power : power;
+      s = e;
+    }
+  }
+  *p = s;
+
+  if (exact && mantissa <= (UINT64_C(1) << 53) && exponent >= -22 &&
+      exponent <= 22) {
+    double v = (double)mantissa;
+    v = exponent < 0 ? v / scene_powers_of_ten[-exponent]
+                     : v * scene_powers_of_ten[exponent];
+    *value = negative ? -v : v;
+    return true;
+  }
+
+  char buffer[128];
+  const size_t length = s - start;
+  if (length >= sizeof(buffer)) {
+    return false;
+  }
+  memcpy(buffer, start, length);
+  buffer[length] = '\0';
+  *value = strtod(buffer, NULL);
+  return true;
+}
+
+// Parses the values of the record in [p, end).
+static bool Scene_parseRecord(const char* p, const char* end,
+                              double values[SCENE_RECORD_VALUES]) {
+  for (int k = 0; k < SCENE_RECORD_VALUES; k++) {
+    while (p < end && !Scene_isNumberStart(*p)) {
+      p++;
+    }
+    if (!Scene_parseNumber(&p, end, &values[k])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns the end of the line starting at p, not counting the newline.
+static inline const char* Scene_lineEnd(const char* p, const char* end) {
+  const char* newline = memchr(p, '\n', end - p);
+  return newline != NULL ? newline : end;
+}
+
+// Returns true if the line [p, end) holds a record rather than being blank.
+static inline bool Scene_isRecord(const char* p, const char* end) {
+  for (; p < end; p++) {
+    if (Scene_isDigit(*p)) return true;
+  }
+  return false;
+}
+
+static inline void Scene_makeLine(Line* line, unsigned int id,
+                                  const double values[SCENE_RECORD_VALUES]) {
+  windowToBox(&line->p1.x, &line->p1.y, values[0], values[1]);
+  windowToBox(&line->p2.x, &line->p2.y, values[2], values[3]);
+  velocityWindowToBox(&line->velocity.x, &line->velocity.y, values[4],
+                      values[5]);
+  line->color = (Color)(int)values[6];
+  line->id = id;
+}
+
+// Parses the records in each of the num_chunks chunks [bounds[c],
+// bounds[c + 1]) in parallel, into a new block of lines. first[c] is filled in
+// with the index of chunk c's first line, and first[num_chunks] with the
+// total. Returns NULL if a record is malformed.
+static Line* Scene_parseChunks(const char* path, const char** bounds,
+                               size_t num_chunks, size_t* first, bool* ok) {
+  cilk_for (size_t c = 0; c < num_chunks; c++) {
+    size_t count = 0;
+    for (const char* p = bounds[c]; p < bounds[c + 1];) {
+      const char* line_end = Scene_lineEnd(p, bounds[c + 1]);
+      count += Scene_isRecord(p, line_end);
+      p = line_end + 1;
+    }
+    first[c + 1] = count;
+  }
+  first[0] = 0;
+  for (size_t c = 0; c < num_chunks; c++) {
+    first[c + 1] += first[c];
+  }
+  const size_t num_lines = first[num_chunks];
+  if (num_lines == 0 || num_lines > UINT_MAX) {
+    fprintf(stderr, "Unsupported number of lines in %s\n", path);
+    return NULL;
+  }
+
+  Line* lines = malloc(num_lines * sizeof(Line));
+  if (lines == NULL) {
+    fprintf(stderr, "Out of memory loading %s\n", path);
+    return NULL;
+  }
+  cilk_for (size_t c = 0; c < num_chunks; c++) {
+    size_t index = first[c];
+    ok[c] = true;
+    for (const char* p = bounds[c]; ok[c] && p < bounds[c + 1];) {
+      const char* line_end = Scene_lineEnd(p, bounds[c + 1]);
+      if (Scene_isRecord(p, line_end)) {
+        double values[SCENE_RECORD_VALUES];
+        ok[c] = Scene_parseRecord(p, line_end, values);
+        if (ok[c]) {
+          Scene_makeLine(&lines[index], index, values);
+        }
+        index++;
+      }
+      p = line_end + 1;
+    }
+  }
+  for (size_t c = 0; c < num_chunks; c++) {
+    if (!ok[c]) {
+      fprintf(stderr, "Malformed line in %s\n", path);
+      free(lines);
+      return NULL;
+    }
+  }
+  return lines;
+}
+
+// Parses the text scene in [data, data + size). The body is split into chunks
+// at line boundaries; the records in each chunk are counted in parallel to
+// find where each chunk's lines go, and then parsed in parallel straight into
+// one block of lines.
+static CollisionWorld* Scene_parseText(const char* path, const char* data,
+                                       size_t size) {
+  const char* const end = data + size;
+  // The first line is the number of lines, which we recount anyway.
+  const char* body = Scene_lineEnd(data, end);
+  body = body < end ? body + 1 : end;
+
+  const size_t num_chunks =
+      (end - body + SCENE_CHUNK_SIZE - 1) / SCENE_CHUNK_SIZE;
+  const char** bounds = malloc((num_chunks + 1) * sizeof(char*));
+  size_t* first = malloc((num_chunks + 1) * sizeof(size_t));
+  bool* ok = malloc((num_chunks + 1) * sizeof(bool));
+  bounds[0] = body;
+  for (size_t c = 1; c < num_chunks; c++) {
+    const char* next = Scene_lineEnd(body + c * SCENE_CHUNK_SIZE - 1, end);
+    next = next < end ? next + 1 : end;
+    bounds[c] = next > bounds[c - 1] ? next : bounds[c - 1];
+  }
+  bounds[num_chunks] = end;
+
+  CollisionWorld* collisionWorld = NULL;
+  Line* lines = Scene_parseChunks(path, bounds, num_chunks, first, ok);
+  if (lines != NULL) {
+    collisionWorld = CollisionWorld_new(first[num_chunks]);
+    CollisionWorld_addLineBlock(collisionWorld, lines, first[num_chunks]);
+  }
+  free(bounds);
+  free(first);
+  free(ok);
+  return collisionWorld;
+}
+
+// Uses the lines of the binary scene mapped at data in place. The mapping is
+// private, so the simulation's writes never reach the file.
+static CollisionWorld* Scene_useBinary(const char* path, char* data,
+                                       size_t size) {
+  SceneHeader header;
+  if (size < sizeof(header)) {
+    fprintf(stderr, "Truncated scene %s\n", path);
+    return NULL;
+  }
+  memcpy(&header, data, sizeof(header));
+  if (header.version != SCENE_VERSION || header.lineSize != sizeof(Line)) {
+    fprintf(stderr, "Scene %s was written by an incompatible version\n", path);
+    return NULL;
+  }
+  if (header.numOfLines == 0 || header.numOfLines > UINT_MAX ||
+      header.numOfLines > (size - sizeof(header)) / sizeof(Line) ||
+      size != sizeof(header) + header.numOfLines * sizeof(Line)) {
+    fprintf(stderr, "Scene %s has a bad number of lines\n", path);
+    return NULL;
+  }
+  const unsigned int num_lines = header.numOfLines;
+  Line* lines = (Line*)(data + sizeof(header));
+  for (unsigned int i = 0; i < num_lines; i++) {
+    if (lines[i].id != i) {
+      fprintf(stderr, "Scene %s has lines out of order\n", path);
+      return NULL;
+    }
+  }
+
+  CollisionWorld* collisionWorld = CollisionWorld_new(num_lines);
+  CollisionWorld_addMappedLineBlock(collisionWorld, lines, num_lines, data,
+                                    size);
+  return collisionWorld;
+}
+
+CollisionWorld* Scene_load(const char* path) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Input file not found (%s)\n", path);
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    fprintf(stderr, "Can't read %s\n", path);
+    close(fd);
+    return NULL;
+  }
+  const size_t size = st.st_size;
+
+  char magic[sizeof(((SceneHeader*)NULL)->magic)] = {0};
+  const bool binary = pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+                      memcmp(magic, SCENE_MAGIC, sizeof(magic)) == 0;
+  char* data = mmap(NULL, size, binary ? PROT_READ | PROT_WRITE : PROT_READ,
+                    MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    fprintf(stderr, "Can't map %s\n", path);
+    return NULL;
+  }
+
+  if (binary) {
+    CollisionWorld* collisionWorld = Scene_useBinary(path, data, size);
+    if (collisionWorld == NULL) {
+      munmap(data, size);
+    }
+    return collisionWorld;
+  }
+  CollisionWorld* collisionWorld = Scene_parseText(path, data, size);
+  munmap(data, size);
+  return collisionWorld;
+}
+
+SceneHeader Scene_makeHeader(uint64_t numOfLines) {
+  SceneHeader header = {
+      .version = SCENE_VERSION,
+      .lineSize = sizeof(Line),
+      .numOfLines = numOfLines,
+      .reserved = 0,
+  };
+  memcpy(header.magic, SCENE_MAGIC, sizeof(SCENE_MAGIC));
+  return header;
+}
+
+bool Scene_writeBinary(const char* path, CollisionWorld* collisionWorld) {
+  FILE* fout = fopen(path, "wb");
+  if (fout == NULL) {
+    return false;
+  }
+  const unsigned int num_lines = CollisionWorld_getNumOfLines(collisionWorld);
+  const SceneHeader header = Scene_makeHeader(num_lines);
+  bool ok = fwrite(&header, sizeof(header), 1, fout) == 1;
+  for (unsigned int i = 0; ok && i < num_lines; i++) {
+    ok = fwrite(CollisionWorld_getLine(collisionWorld, i), sizeof(Line), 1,
+                fout) == 1;
+  }
+  return fclose(fout) == 0 && ok;
+}
+
+bool Scene_writeText(const char* path, CollisionWorld* collisionWorld) {
+  FILE* fout = fopen(path, "w");
+  if (fout == NULL) {
+    return false;
+  }
+  const unsigned int num_lines = CollisionWorld_getNumOfLines(collisionWorld);
+  bool ok = fprintf(fout, "%u\n", num_lines) > 0;
+  for (unsigned int i = 0; ok && i < num_lines; i++) {
+    const Line* line = CollisionWorld_getLine(collisionWorld, i);
+    window_dimension x1, y1, x2, y2;
+    boxToWindow(&x1, &y1, line->p1.x, line->p1.y);
+    boxToWindow(&x2, &y2, line->p2.x, line->p2.y);
+    const window_dimension vx =
+        line->velocity.x / ((double)BOX_XMAX - BOX_XMIN) * WINDOW_WIDTH;
+    const window_dimension vy =
+        line->velocity.y / ((double)BOX_YMAX - BOX_YMIN) * WINDOW_HEIGHT;
+    ok = fprintf(fout, "(%.17g, %.17g), (%.17g, %.17g), %.17g, %.17g, %d\n",
+                 x1, y1, x2, y2, vx, vy, (int)line->color) > 0;
+  }
+  return fclose(fout) == 0 && ok;
+}
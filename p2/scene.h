@@ -0,0 +1,49 @@
+#ifndef SCENE_H_
+#define SCENE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "./collision_world.h"
+
+// Scenes come in two formats. The text format has the number of lines on the
+// first line, followed by one line per Line:
+//
+//   (x1, y1), (x2, y2), vx, vy, gray
+//
+// in window coordinates. The binary format is a SceneHeader followed by the
+// Line structs themselves, in box coordinates and in the machine's own layout,
+// so that it can be mapped and used in place.
+
+#define SCENE_MAGIC "P2SCENE"
+#define SCENE_VERSION 1
+
+struct SceneHeader {
+  // SCENE_MAGIC, NUL padded.
+  char magic[8];
+  uint32_t version;
+  // sizeof(Line) of the machine that wrote the file.
+  uint32_t lineSize;
+  uint64_t numOfLines;
+  uint64_t reserved;
+};
+typedef struct SceneHeader SceneHeader;
+
+// Text files are parsed in parallel in chunks of about this many bytes.
+#define SCENE_CHUNK_SIZE (1 << 16)
+
+// Loads the scene at path, in either format, into a new CollisionWorld.
+// Returns NULL and prints why on stderr if the file can't be loaded.
+CollisionWorld* Scene_load(const char* path);
+
+// Returns the header of a binary scene of numOfLines lines, which are to
+// follow it. Lets tools write binary scenes without building a
+// CollisionWorld.
+SceneHeader Scene_makeHeader(uint64_t numOfLines);
+
+// Writes the lines of collisionWorld to path in the binary or the text format.
+// Returns false if the file can't be written.
+bool Scene_writeBinary(const char* path, CollisionWorld* collisionWorld);
+bool Scene_writeText(const char* path, CollisionWorld* collisionWorld);
+
+#endif  // SCENE_H_
@@ -0,0 +1,49 @@
+// Converts screensaver scenes between the text format and the binary format
+// that can be mapped and used in place. See scene.h.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "./collision_world.h"
+#include "./scene.h"
+
+int main(int argc, char* argv[]) {
+  int optchar;
+  bool textFlag = false;
+
+  while ((optchar = getopt(argc, argv, "t")) != -1) {
+    switch (optchar) {
+      case 't':
+        textFlag = true;
+        break;
+      default:
+        printf("Ignoring unrecognized option: %c\n", optchar);
+        continue;
+    }
+  }
+
+  if (argc - optind != 2) {
+    printf("Usage: %s [-t] <inputfile> <outputfile>\n", argv[0]);
+    printf("  Reads a scene in either format and writes it in the binary\n");
+    printf("  format, or in the text format with -t.\n");
+    exit(-1);
+  }
+  const char* input = argv[optind];
+  const char* output = argv[optind + 1];
+
+  CollisionWorld* collisionWorld = Scene_load(input);
+  if (collisionWorld == NULL) {
+    exit(1);
+  }
+  const bool ok = textFlag ? Scene_writeText(output, collisionWorld)
+                           : Scene_writeBinary(output, collisionWorld);
+  if (!ok) {
+    fprintf(stderr, "Can't write %s\n", output);
+    exit(1);
+  }
+  printf("Wrote %u lines to %s\n", CollisionWorld_getNumOfLines(collisionWorld),
+         output);
+  CollisionWorld_delete(collisionWorld);
+  return 0;
+}
@@ -0,0 +1,265 @@
+// Writes random screensaver scenes of any size for scaling tests, in the text
+// format or the binary format of scene.h. Lines are generated and written one
+// at a time, so scenes of tens of millions of lines need no memory to speak
+// of. The same seed always gives the same scene.
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "./line.h"
+#include "./scene.h"
+
+// Attempts at placing a line inside the window before it is shrunk to fit.
+#define SCENEGEN_MAX_TRIES 100
+
+typedef enum { DIST_FIXED, DIST_UNIFORM, DIST_EXPONENTIAL } LengthDist;
+typedef enum { VEL_UNIFORM, VEL_GAUSSIAN } VelocityDist;
+
+struct SceneGenParams {
+  uint64_t numOfLines;
+  // Line lengths have this mean, in pixels.
+  LengthDist lengthDist;
+  double meanLength;
+  // With clusters > 0, line centers are normally distributed around that
+  // many random cluster centers with standard deviation clusterRadius.
+  // Otherwise they are uniform over the window.
+  unsigned int clusters;
+  double clusterRadius;
+  // Velocity components are uniform in [-speed, speed] or normal with
+  // standard deviation speed, in pixels per time step.
+  VelocityDist velocityDist;
+  double speed;
+  // Fraction of lines that don't move.
+  double staticFraction;
+  uint64_t seed;
+  bool binary;
+};
+typedef struct SceneGenParams SceneGenParams;
+
+// splitmix64, so that scenes don't depend on the C library's rand().
+static uint64_t rng_state;
+
+static inline uint64_t rng_next() {
+  uint64_t z = (rng_state += UINT64_C(0x9E3779B97F4A7C15));
+  z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+  return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1).
+static inline double rng_uniform() { return (rng_next() >> 11) * 0x1.0p-53; }
+
+// Standard normal, by Box-Muller.
+static inline double rng_gaussian() {
+  const double u = 1.0 - rng_uniform();
+  const double v = rng_uniform();
+  return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+static inline bool inWindow(double x, double y) {
+  return x >= 0 && x < WINDOW_WIDTH && y >= 0 && y < WINDOW_HEIGHT;
+}
+
+static double sampleLength(const SceneGenParams* params) {
+  switch (params->lengthDist) {
+    case DIST_UNIFORM:
+      return 2.0 * params->meanLength * rng_uniform();
+    case DIST_EXPONENTIAL:
+      return -params->meanLength * log(1.0 - rng_uniform());
+    default:
+      return params->meanLength;
+  }
+}
+
+static double sampleVelocity(const SceneGenParams* params) {
+  if (params->velocityDist == VEL_GAUSSIAN) {
+    return params->speed * rng_gaussian();
+  }
+  return params->speed * (2.0 * rng_uniform() - 1.0);
+}
+
+// Picks the center of a line.
+static void sampleCenter(const SceneGenParams* params, const double* centers,
+                         double* x, double* y) {
+  if (params->clusters == 0) {
+    *x = WINDOW_WIDTH * rng_uniform();
+    *y = WINDOW_HEIGHT * rng_uniform();
+    return;
+  }
+  const unsigned int c = rng_next() % params->clusters;
+  *x = centers[2 * c] + params->clusterRadius * rng_gaussian();
+  *y = centers[2 * c + 1] + params->clusterRadius * rng_gaussian();
+}
+
+// Rounds to the 6 decimals the text format keeps, so that the text and binary
+// scenes of a seed are the same scene.
+static inline double quantize(double value) { return round(value * 1e6) / 1e6; }
+
+// Generates a line in window coordinates: its endpoints, velocity and color.
+static void generateLine(const SceneGenParams* params, const double* centers,
+                         double values[7]) {
+  const double length = sampleLength(params);
+  double cx = 0, cy = 0, dx = 0, dy = 0;
+  bool placed = false;
+  for (int tries = 0; tries < SCENEGEN_MAX_TRIES && !placed; tries++) {
+    sampleCenter(params, centers, &cx, &cy);
+    const double angle = M_PI * rng_uniform();
+    dx = 0.5 * length * cos(angle);
+    dy = 0.5 * length * sin(angle);
+    placed = inWindow(cx - dx, cy - dy) && inWindow(cx + dx, cy + dy);
+  }
+  if (!placed) {
+    // Fall back to a uniform center and a line short enough to fit.
+    cx = WINDOW_WIDTH * rng_uniform();
+    cy = WINDOW_HEIGHT * rng_uniform();
+    const double room = fmin(fmin(cx, WINDOW_WIDTH - cx),
+                             fmin(cy, WINDOW_HEIGHT - cy));
+    const double scale = fmin(1.0, room / fmax(fabs(dx), fabs(dy)));
+    dx *= scale;
+    dy *= scale;
+  }
+
+  const bool moving = rng_uniform() >= params->staticFraction;
+  values[0] = quantize(cx - dx);
+  values[1] = quantize(cy - dy);
+  values[2] = quantize(cx + dx);
+  values[3] = quantize(cy + dy);
+  values[4] = moving ? quantize(sampleVelocity(params)) : 0.0;
+  values[5] = moving ? quantize(sampleVelocity(params)) : 0.0;
+  // Static lines are drawn gray.
+  values[6] = moving ? RED : GRAY;
+}
+
+static bool generate(const SceneGenParams* params, FILE* fout) {
+  rng_state = params->seed;
+  double* centers = malloc(2 * (params->clusters + 1) * sizeof(double));
+  for (unsigned int c = 0; c < params->clusters; c++) {
+    centers[2 * c] = WINDOW_WIDTH * rng_uniform();
+    centers[2 * c + 1] = WINDOW_HEIGHT * rng_uniform();
+  }
+
+  bool ok;
+  if (params->binary) {
+    const SceneHeader header = Scene_makeHeader(params->numOfLines);
+    ok = fwrite(&header, sizeof(header), 1, fout) == 1;
+  } else {
+    ok = fprintf(fout, "%" PRIu64 "\n", params->numOfLines) > 0;
+  }
+  for (uint64_t i = 0; ok && i < params->numOfLines; i++) {
+    double values[7];
+    generateLine(params, centers, values);
+    if (params->binary) {
+      Line line;
+      memset(&line, 0, sizeof(line));
+      windowToBox(&line.p1.x, &line.p1.y, values[0], values[1]);
+      windowToBox(&line.p2.x, &line.p2.y, values[2], values[3]);
+      velocityWindowToBox(&line.velocity.x, &line.velocity.y, values[4],
+                          values[5]);
+      line.color = (Color)values[6];
+      line.id = i;
+      ok = fwrite(&line, sizeof(line), 1, fout) == 1;
+    } else {
+      ok = fprintf(fout, "(%f, %f), (%f, %f), %f, %f, %d\n", values[0],
+                   values[1], values[2], values[3], values[4], values[5],
+                   (int)values[6]) > 0;
+    }
+  }
+  free(centers);
+  return ok;
+}
+
+static void usage(char* program) {
+  printf("Usage: %s [options] <numLines> <outputfile>\n", program);
+  printf("  -l length : mean line length in pixels (10)\n");
+  printf("  -L dist   : length distribution, fixed, uniform (default) or exp\n");
+  printf("  -c n      : cluster line centers around n random points (0 = "
+         "uniform)\n");
+  printf("  -r radius : standard deviation of a cluster in pixels (50)\n");
+  printf("  -v speed  : velocity scale in pixels per time step (1)\n");
+  printf("  -V dist   : velocity distribution, uniform (default) or gauss\n");
+  printf("  -s frac   : fraction of lines that don't move (0)\n");
+  printf("  -S seed   : random seed (1)\n");
+  printf("  -b        : write the binary format instead of text\n");
+}
+
+int main(int argc, char* argv[]) {
+  int optchar;
+  SceneGenParams params = {
+      .numOfLines = 0,
+      .lengthDist = DIST_UNIFORM,
+      .meanLength = 10,
+      .clusters = 0,
+      .clusterRadius = 50,
+      .velocityDist = VEL_UNIFORM,
+      .speed = 1,
+      .staticFraction = 0,
+      .seed = 1,
+      .binary = false,
+  };
+
+  while ((optchar = getopt(argc, argv, "l:L:c:r:v:V:s:S:bh")) != -1) {
+    switch (optchar) {
+      case 'l':
+        params.meanLength = atof(optarg);
+        break;
+      case 'L':
+        if (strcmp(optarg, "fixed") == 0) {
+          params.lengthDist = DIST_FIXED;
+        } else if (strcmp(optarg, "exp") == 0) {
+          params.lengthDist = DIST_EXPONENTIAL;
+        } else {
+          params.lengthDist = DIST_UNIFORM;
+        }
+        break;
+      case 'c':
+        params.clusters = atoi(optarg) > 0 ? atoi(optarg) : 0;
+        break;
+      case 'r':
+        params.clusterRadius = atof(optarg);
+        break;
+      case 'v':
+        params.speed = atof(optarg);
+        break;
+      case 'V':
+        params.velocityDist =
+            strcmp(optarg, "gauss") == 0 ? VEL_GAUSSIAN : VEL_UNIFORM;
+        break;
+      case 's':
+        params.staticFraction = atof(optarg);
+        break;
+      case 'S':
+        params.seed = strtoull(optarg, NULL, 0);
+        break;
+      case 'b':
+        params.binary = true;
+        break;
+      default:
+        usage(argv[0]);
+        exit(-1);
+    }
+  }
+
+  if (argc - optind != 2 || atoll(argv[optind]) <= 0) {
+    usage(argv[0]);
+    exit(-1);
+  }
+  params.numOfLines = strtoull(argv[optind], NULL, 10);
+  const char* output = argv[optind + 1];
+
+  FILE* fout = fopen(output, params.binary ? "wb" : "w");
+  if (fout == NULL) {
+    fprintf(stderr, "Can't open %s\n", output);
+    exit(1);
+  }
+  const bool ok = generate(&params, fout);
+  if (fclose(fout) != 0 || !ok) {
+    fprintf(stderr, "Can't write %s\n", output);
+    exit(1);
+  }
+  return 0;
+}
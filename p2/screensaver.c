@@ -21,8 +21,11 @@
  **/
 
 #include <cilk/cilk.h>
+#include <getopt.h>
+#include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "./cilktool.h"
@@ -48,28 +51,135 @@ void lineMain(LineDemo* lineDemo) {
   }
 }
 
+// Number of frames each candidate setting is timed for by --autotune.
+#define AUTOTUNE_FRAMES 20
+
+// Times AUTOTUNE_FRAMES frames of a fresh copy of the input scene with the
+// quadtree shaped by params.
+static double autotuneTrial(QuadTreeParams params, bool soaFlag) {
+  LineDemo* lineDemo = LineDemo_new();
+  LineDemo_initLine(lineDemo);
+  if (soaFlag) {
+    LineDemo_useSoA(lineDemo);
+  }
+  LineDemo_setQuadTreeParams(lineDemo, params);
+  LineDemo_setNumFrames(lineDemo, AUTOTUNE_FRAMES);
+  const fasttime_t start_time = gettime();
+  lineMain(lineDemo);
+  const fasttime_t end_time = gettime();
+  LineDemo_delete(lineDemo);
+  return tdiff(start_time, end_time);
+}
+
+// Replaces *best with params if they run faster.
+static void autotuneTry(QuadTreeParams* best, double* bestTime,
+                        QuadTreeParams params, bool soaFlag) {
+  const double time = autotuneTrial(params, soaFlag);
+  if (time < *bestTime) {
+    *best = params;
+    *bestTime = time;
+  }
+}
+
+// Picks quadtree parameters for the input by coordinate descent: each
+// capacity is tried first, then each depth limit with the best capacity, and
+// then each minimum cell size with the best of both.
+static QuadTreeParams autotune(bool soaFlag) {
+  static const uint32_t capacities[] = {1, 2, 4, 8, 16, 32};
+  static const uint32_t depths[] = {4, 6, 8, 12};
+  // As fractions of the box width.
+  static const double minCells[] = {1.0 / 128, 1.0 / 64, 1.0 / 32};
+
+  QuadTreeParams best = QuadTreeParams_default();
+  double bestTime = autotuneTrial(best, soaFlag);
+  for (int i = 0; i < sizeof(capacities) / sizeof(capacities[0]); i++) {
+    QuadTreeParams params = best;
+    params.capacity = capacities[i];
+    autotuneTry(&best, &bestTime, params, soaFlag);
+  }
+  for (int i = 0; i < sizeof(depths) / sizeof(depths[0]); i++) {
+    QuadTreeParams params = best;
+    params.max_depth = depths[i];
+    autotuneTry(&best, &bestTime, params, soaFlag);
+  }
+  for (int i = 0; i < sizeof(minCells) / sizeof(minCells[0]); i++) {
+    QuadTreeParams params = best;
+    params.min_cell = minCells[i] * (BOX_XMAX - BOX_XMIN);
+    autotuneTry(&best, &bestTime, params, soaFlag);
+  }
+  return best;
+}
+
 int main(int argc, char* argv[]) {
   int optchar;
 #ifndef PROFILE_BUILD
   bool graphicDemoFlag = false;
 #endif
+  bool soaFlag = false;
+  bool autotuneFlag = false;
+  BroadPhase broadPhase = BROAD_PHASE_QUADTREE;
+  QuadTreeParams quadTreeParams = QuadTreeParams_default();
   unsigned int numFrames = 1;
   extern int optind;
 
+  static const struct option longOptions[] = {
+      {"autotune", no_argument, NULL, 'a'},
+      {"qt-capacity", required_argument, NULL, 'c'},
+      {"qt-depth", required_argument, NULL, 'd'},
+      {"qt-min-cell", required_argument, NULL, 'm'},
+      {NULL, 0, NULL, 0},
+  };
+
   // Process command line options.
-  while ((optchar = getopt(argc, argv, "gi")) != -1) {
+  while ((optchar = getopt_long(argc, argv, "gisb:", longOptions, NULL)) !=
+         -1) {
     switch (optchar) {
       case 'g':
 #ifndef PROFILE_BUILD
         graphicDemoFlag = true;
 #endif
         break;
+      case 's':
+        soaFlag = true;
+        break;
+      case 'b':
+        if (strcmp(optarg, "quadtree") == 0) {
+          broadPhase = BROAD_PHASE_QUADTREE;
+        } else if (strcmp(optarg, "grid") == 0) {
+          broadPhase = BROAD_PHASE_GRID;
+        } else if (strcmp(optarg, "sweep") == 0) {
+          broadPhase = BROAD_PHASE_SWEEP;
+        } else if (strcmp(optarg, "morton") == 0) {
+          broadPhase = BROAD_PHASE_MORTON;
+        } else {
+          printf("Ignoring unrecognized broad phase: %s\n", optarg);
+        }
+        break;
+      case 'a':
+        autotuneFlag = true;
+        break;
+      case 'c':
+        quadTreeParams.capacity = atoi(optarg) > 0 ? atoi(optarg) : 1;
+        break;
+      case 'd':
+        quadTreeParams.max_depth = atoi(optarg) > 0 ? atoi(optarg) : 0;
+        break;
+      case 'm':
+        quadTreeParams.min_cell = atof(optarg);
+        break;
       default:
         printf("Ignoring unrecognized option: %c\n", optchar);
         continue;
     }
   }
 
+  // The trials time the quadtree, so its parameters mean nothing to the
+  // other broad phases.
+  if (autotuneFlag && broadPhase != BROAD_PHASE_QUADTREE) {
+    printf("--autotune only tunes the quadtree broad phase\n");
+    exit(-1);
+  }
+
   // Shift remaining arguments over.
   int remaining_args = argc - optind;
   for (int i = 1; i <= remaining_args; i++) {
@@ -78,8 +188,19 @@ int main(int argc, char* argv[]) {
 
   // Check to make sure number of arguments is correct.
   if (remaining_args < 1) {
-    printf("Usage: %s [-g] <numFrames> [inputfile]\n", argv[0]);
+    printf("Usage: %s [-g] [-s] [-b engine] [quadtree options] <numFrames> "
+           "[inputfile]\n",
+           argv[0]);
     printf("  -g : show graphics\n");
+    printf("  -s : store lines as structure of arrays (SIMD updates)\n");
+    printf("  -b : broad phase, quadtree (default), grid, sweep or morton\n");
+    printf("  --qt-capacity n : lines per quadtree leaf before splitting (%d)\n",
+           QT_SOFT_CAPACITY);
+    printf("  --qt-depth n : maximum quadtree depth (%d)\n", QT_MAX_DEPTH);
+    printf("  --qt-min-cell x : smallest quadtree cell side (%g)\n",
+           QT_MIN_CELL);
+    printf("  --autotune : time a few frames of the input at several quadtree\n"
+           "               settings and use the fastest (quadtree only)\n");
     exit(-1);
   }
 
@@ -97,6 +218,17 @@ int main(int argc, char* argv[]) {
   LineDemo* lineDemo = LineDemo_new();
   LineDemo_setInputFile(input_file_path);
   LineDemo_initLine(lineDemo);
+  if (soaFlag) {
+    LineDemo_useSoA(lineDemo);
+  }
+  LineDemo_setBroadPhase(lineDemo, broadPhase);
+  if (autotuneFlag) {
+    quadTreeParams = autotune(soaFlag);
+    printf("Autotuned quadtree: capacity %u, max depth %u, min cell %g\n",
+           quadTreeParams.capacity, quadTreeParams.max_depth,
+           quadTreeParams.min_cell);
+  }
+  LineDemo_setQuadTreeParams(lineDemo, quadTreeParams);
   LineDemo_setNumFrames(lineDemo, numFrames);
 
   const fasttime_t start_time = gettime();
@@ -121,6 +253,14 @@ int main(int argc, char* argv[]) {
          LineDemo_getNumLineWallCollisions(lineDemo));
   printf("%u Line-Line Collisions\n",
          LineDemo_getNumLineLineCollisions(lineDemo));
+  const uint64_t rejected = LineDemo_getNumPairsRejected(lineDemo);
+  const uint64_t tested = LineDemo_getNumPairsTested(lineDemo);
+  if (rejected + tested > 0) {
+    printf("%" PRIu64 " of %" PRIu64
+           " candidate pairs rejected by swept boxes (%.1f%%)\n",
+           rejected, rejected + tested,
+           100.0 * rejected / (rejected + tested));
+  }
   printf("---- END RESULTS ----\n");
 
   // delete objects
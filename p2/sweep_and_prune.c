@@ -0,0 +1,75 @@
+#include "sweep_and_prune.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+SweepAndPrune* SweepAndPrune_new() {
+  SweepAndPrune* sap = malloc(sizeof(SweepAndPrune));
+  *sap = (SweepAndPrune){
+      .endpoints = NULL,
+      .num_lines = 0,
+  };
+  return sap;
+}
+
+void SweepAndPrune_delete(SweepAndPrune* sap) {
+  if (sap == NULL) return;
+  free(sap->endpoints);
+  free(sap);
+}
+
+static inline bool SweepEndpoint_less(SweepEndpoint a, SweepEndpoint b) {
+  if (a.value != b.value) return a.value < b.value;
+  return !SweepEndpoint_isMax(a) && SweepEndpoint_isMax(b);
+}
+
+static int SweepEndpoint_compare(const void* a, const void* b) {
+  const SweepEndpoint* ea = a;
+  const SweepEndpoint* eb = b;
+  if (SweepEndpoint_less(*ea, *eb)) return -1;
+  if (SweepEndpoint_less(*eb, *ea)) return 1;
+  return 0;
+}
+
+void SweepAndPrune_update(SweepAndPrune* sap, const LineGeom* geom,
+                          uint32_t num_lines) {
+  assert(num_lines < SAP_MAX_FLAG);
+  const uint32_t num_endpoints = 2 * num_lines;
+  const bool rebuild = sap->endpoints == NULL || sap->num_lines != num_lines;
+  if (rebuild) {
+    free(sap->endpoints);
+    sap->endpoints = malloc(num_endpoints * sizeof(SweepEndpoint));
+    assert(num_endpoints == 0 || sap->endpoints != NULL);
+    sap->num_lines = num_lines;
+    for (uint32_t i = 0; i < num_lines; i++) {
+      sap->endpoints[2 * i].tag = i;
+      sap->endpoints[2 * i + 1].tag = i | SAP_MAX_FLAG;
+    }
+  }
+
+  SweepEndpoint* const endpoints = sap->endpoints;
+  for (uint32_t i = 0; i < num_endpoints; i++) {
+    SweepEndpoint* e = &endpoints[i];
+    const LineGeom* g = &geom[SweepEndpoint_id(*e)];
+    e->value = SweepEndpoint_isMax(*e) ? g->xmax : g->xmin;
+  }
+
+  if (rebuild) {
+    qsort(endpoints, num_endpoints, sizeof(SweepEndpoint),
+          SweepEndpoint_compare);
+    return;
+  }
+
+  // The lines only moved by one time step, so each endpoint is usually at
+  // most a few places from where it belongs and insertion sort is close to
+  // linear.
+  for (uint32_t i = 1; i < num_endpoints; i++) {
+    const SweepEndpoint e = endpoints[i];
+    uint32_t j = i;
+    while (j > 0 && SweepEndpoint_less(e, endpoints[j - 1])) {
+      endpoints[j] = endpoints[j - 1];
+      j--;
+    }
+    endpoints[j] = e;
+  }
+}
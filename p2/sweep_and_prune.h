@@ -0,0 +1,48 @@
+#ifndef SWEEP_AND_PRUNE_H_
+#define SWEEP_AND_PRUNE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "linepg.h"
+
+// Set in SweepEndpoint.tag for the upper end of an interval.
+#define SAP_MAX_FLAG 0x80000000u
+
+// One end of a line's swept interval on the x axis.
+struct SweepEndpoint {
+  double value;
+  // ID of the line, with SAP_MAX_FLAG set for xmax and clear for xmin.
+  uint32_t tag;
+};
+typedef struct SweepEndpoint SweepEndpoint;
+
+// Sweep and prune on the x axis, kept alive across frames. The endpoints stay
+// sorted from one frame to the next, so that re-sorting them after the lines
+// have moved a little is close to linear.
+struct SweepAndPrune {
+  // The 2 * num_lines endpoints, ordered by value with lower ends first on
+  // ties, so that touching intervals count as overlapping.
+  SweepEndpoint* endpoints;
+  uint32_t num_lines;
+};
+typedef struct SweepAndPrune SweepAndPrune;
+
+SweepAndPrune* SweepAndPrune_new();
+void SweepAndPrune_delete(SweepAndPrune* sap);
+
+// Brings the endpoints up to date with the swept boxes in geom, where geom[i]
+// is the geometry of line i, and sorts them. The endpoints are rebuilt from
+// scratch on the first call or when num_lines changes.
+void SweepAndPrune_update(SweepAndPrune* sap, const LineGeom* geom,
+                          uint32_t num_lines);
+
+static inline uint32_t SweepEndpoint_id(SweepEndpoint e) {
+  return e.tag & ~SAP_MAX_FLAG;
+}
+
+static inline bool SweepEndpoint_isMax(SweepEndpoint e) {
+  return (e.tag & SAP_MAX_FLAG) != 0;
+}
+
+#endif
@@ -20,17 +20,18 @@
  * SOFTWARE.
  **/
 
-// Simple 2D vector library
+// Simple 2D vector library. Everything is inline: the single-vector
+// functions work on __m128d, and the Vec4 functions work on four vectors at
+// once for structure-of-arrays data.
 #ifndef VEC_H_
 #define VEC_H_
 
+#include <immintrin.h>
+#include <math.h>
 #include <stdbool.h>
 
 typedef double vec_dimension;
 
-// Forward definition of Line to avoid needing to circularly include Line.h
-struct Line;
-
 // A two-dimensional vector.
 struct Vec {
   vec_dimension x;  // The x-coordinate of the vector.
@@ -38,45 +39,151 @@ struct Vec {
 };
 typedef struct Vec Vec;
 
+// Returns the vector in one register, x in the low lane.
+static inline __m128d Vec_toM128d(Vec vector) {
+  return _mm_loadu_pd(&vector.x);
+}
+
+// Inverse of Vec_toM128d.
+static inline Vec Vec_fromM128d(__m128d m) {
+  Vec vector;
+  _mm_storeu_pd(&vector.x, m);
+  return vector;
+}
+
 // Returns a vector with the specified x and y coordinates.
-Vec Vec_make(const vec_dimension x, const vec_dimension y);
+static inline Vec Vec_make(const vec_dimension x, const vec_dimension y) {
+  Vec vector;
+  vector.x = x;
+  vector.y = y;
+  return vector;
+}
+
+// ******************************* Arithmetic ********************************
+
+static inline bool Vec_equals(Vec lhs, Vec rhs) {
+  return _mm_movemask_pd(_mm_cmpeq_pd(Vec_toM128d(lhs), Vec_toM128d(rhs))) ==
+         3;
+}
+
+static inline Vec Vec_add(Vec lhs, Vec rhs) {
+  return Vec_fromM128d(_mm_add_pd(Vec_toM128d(lhs), Vec_toM128d(rhs)));
+}
+
+static inline Vec Vec_subtract(Vec lhs, Vec rhs) {
+  return Vec_fromM128d(_mm_sub_pd(Vec_toM128d(lhs), Vec_toM128d(rhs)));
+}
+
+static inline Vec Vec_multiply(Vec vector, const double scalar) {
+  return Vec_fromM128d(_mm_mul_pd(Vec_toM128d(vector), _mm_set1_pd(scalar)));
+}
+
+static inline Vec Vec_divide(Vec vector, const double scalar) {
+  return Vec_fromM128d(_mm_div_pd(Vec_toM128d(vector), _mm_set1_pd(scalar)));
+}
 
-// Returns a vector parallel to the provided Line.  The direction of the
-// vector is unspecified.
-Vec Vec_makeFromLine(struct Line line);
+// Computes the dot product of two vectors.
+static inline vec_dimension Vec_dotProduct(Vec lhs, Vec rhs) {
+  const __m128d products = _mm_mul_pd(Vec_toM128d(lhs), Vec_toM128d(rhs));
+  return _mm_cvtsd_f64(
+      _mm_add_sd(products, _mm_unpackhi_pd(products, products)));
+}
+
+// Computes the magnitude of the cross product of two vectors.
+static inline vec_dimension Vec_crossProduct(Vec lhs, Vec rhs) {
+  const __m128d rhs_yx = _mm_shuffle_pd(Vec_toM128d(rhs), Vec_toM128d(rhs), 1);
+  const __m128d products = _mm_mul_pd(Vec_toM128d(lhs), rhs_yx);
+  return _mm_cvtsd_f64(
+      _mm_sub_sd(products, _mm_unpackhi_pd(products, products)));
+}
+
+// ************************* Fundamental attributes **************************
 
 // Returns the magnitude of the vector.
-vec_dimension Vec_length(Vec vector);
+static inline vec_dimension Vec_length(Vec vector) {
+  return hypot(vector.x, vector.y);
+}
 
 // Returns the argument of the vector - that is, the angle it makes with the
 // positive x axis.  Units are radians.
-double Vec_argument(Vec vector);
+static inline double Vec_argument(Vec vector) {
+  return atan2(vector.y, vector.x);
+}
+
+// **************************** Related vectors ******************************
 
 // Returns a unit vector parallel to the vector.
-Vec Vec_normalize(Vec vector);
+static inline Vec Vec_normalize(Vec vector) {
+  return Vec_divide(vector, Vec_length(vector));
+}
 
 // Returns a vector identical in magnitude and perpendicular to the vector.
-Vec Vec_orthogonal(Vec vector);
+static inline Vec Vec_orthogonal(Vec vector) {
+  return Vec_make(-vector.y, vector.x);
+}
+
+// ******************** Relationships with other vectors *********************
 
 // Computes the angle between vector1 and vector2.
-double Vec_angle(Vec vector1, Vec vector2);
+static inline double Vec_angle(Vec vector1, Vec vector2) {
+  return Vec_argument(vector1) - Vec_argument(vector2);
+}
 
 // Computes the scalar component of vector1 onto vector2.
-vec_dimension Vec_component(Vec vector1, Vec vector2);
+static inline vec_dimension Vec_component(Vec vector1, Vec vector2) {
+  return Vec_length(vector1) * cos(Vec_angle(vector1, vector2));
+}
 
 // Returns the vector projection of vector1 onto vector2.
-Vec Vec_projectOnto(Vec vector1, Vec vector2);
+static inline Vec Vec_projectOnto(Vec vector1, Vec vector2) {
+  return Vec_multiply(Vec_normalize(vector2), Vec_component(vector1, vector2));
+}
 
-bool Vec_equals(Vec lhs, Vec rhs);
-Vec Vec_add(Vec lhs, Vec rhs);
-Vec Vec_subtract(Vec lhs, Vec rhs);
-Vec Vec_multiply(Vec vector, const double scalar);
-Vec Vec_divide(Vec vector, const double scalar);
+// ***************************** Four at a time ******************************
 
-// Computes the dot product of two vectors.
-vec_dimension Vec_dotProduct(Vec lhs, Vec rhs);
+// Marks functions that use AVX2. Only call them, and the Vec4 functions,
+// from such functions, after checking __builtin_cpu_supports("avx2").
+#define VEC_AVX2 __attribute__((target("avx2")))
 
-// Computes the magnitude of the cross product of two vectors.
-vec_dimension Vec_crossProduct(Vec lhs, Vec rhs);
+// Four two-dimensional vectors, one per lane.
+struct Vec4 {
+  __m256d x;
+  __m256d y;
+};
+typedef struct Vec4 Vec4;
+
+// Loads four vectors from structure-of-arrays data. x and y must be 32-byte
+// aligned.
+VEC_AVX2 static inline Vec4 Vec4_load(const double* x, const double* y) {
+  return (Vec4){.x = _mm256_load_pd(x), .y = _mm256_load_pd(y)};
+}
+
+// Inverse of Vec4_load.
+VEC_AVX2 static inline void Vec4_store(double* x, double* y, Vec4 v) {
+  _mm256_store_pd(x, v.x);
+  _mm256_store_pd(y, v.y);
+}
+
+VEC_AVX2 static inline Vec4 Vec4_add(Vec4 lhs, Vec4 rhs) {
+  return (Vec4){.x = _mm256_add_pd(lhs.x, rhs.x),
+                .y = _mm256_add_pd(lhs.y, rhs.y)};
+}
+
+VEC_AVX2 static inline Vec4 Vec4_subtract(Vec4 lhs, Vec4 rhs) {
+  return (Vec4){.x = _mm256_sub_pd(lhs.x, rhs.x),
+                .y = _mm256_sub_pd(lhs.y, rhs.y)};
+}
+
+// Multiplies each vector by the scalar in its lane.
+VEC_AVX2 static inline Vec4 Vec4_multiply(Vec4 vector, __m256d scalar) {
+  return (Vec4){.x = _mm256_mul_pd(vector.x, scalar),
+                .y = _mm256_mul_pd(vector.y, scalar)};
+}
+
+// Same as Vec_crossProduct, lane by lane.
+VEC_AVX2 static inline __m256d Vec4_crossProduct(Vec4 lhs, Vec4 rhs) {
+  return _mm256_sub_pd(_mm256_mul_pd(lhs.x, rhs.y),
+                       _mm256_mul_pd(lhs.y, rhs.x));
+}
 
 #endif  // VEC_H_